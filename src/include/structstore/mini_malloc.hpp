@@ -7,6 +7,29 @@ namespace structstore {
 
 struct mini_malloc;
 
+// number of size classes of free blocks
+constexpr size_t MM_SIZE_CLASSES = 59;
+
+struct mm_stats {
+    // size of the whole block of memory
+    size_t total_bytes;
+    // usable size of all allocated blocks
+    size_t used_bytes;
+    // usable size of all free blocks
+    size_t free_bytes;
+    size_t largest_free_block;
+    // number of currently allocated blocks
+    size_t allocation_count;
+    // maximum of used_bytes so far
+    size_t high_water_bytes;
+    size_t failed_allocations;
+    // 1 - largest_free_block / free_bytes; 0 if all free memory is in one block
+    double fragmentation;
+    // smallest block size of each size class and the free bytes in blocks of that class
+    size_t class_sizes[MM_SIZE_CLASSES];
+    size_t class_free_bytes[MM_SIZE_CLASSES];
+};
+
 // this function must be called exactly once before the first call to sh_alloc or mm_free,
 // with a block of memory and its size as parameters
 void init_mini_malloc(mini_malloc* sh_alloc, size_t blocksize);
@@ -14,9 +37,45 @@ void init_mini_malloc(mini_malloc* sh_alloc, size_t blocksize);
 // returns a pointer to size bytes of memory, aligned to 8 bytes
 void* mm_allocate(mini_malloc* sh_alloc, size_t size);
 
+// returns a pointer to size bytes of memory, aligned to alignment bytes, which must be a
+// power of two; the alignment refers to the address in the current process
+void* mm_allocate_aligned(mini_malloc* sh_alloc, size_t size, size_t alignment);
+
+// returns a block of size bytes aligned to alignment bytes which starts below limit, taking
+// the free block at the lowest address which fits, or NULL if there is none. this searches
+// all free blocks and is meant for moving blocks towards the start of the memory
+void* mm_allocate_low(mini_malloc* sh_alloc, size_t size, size_t alignment, const void* limit);
+
 // free a block of memory previously allocated by sh_alloc
 void mm_free(mini_malloc* sh_alloc, const void* ptr);
 
+// resizes a block previously allocated by mm_allocate without moving it, by taking over the
+// adjacent free block or by giving back its end; returns false if this is not possible
+bool mm_resize(mini_malloc* sh_alloc, const void* ptr, size_t size);
+
+// like realloc: resizes the block in place if possible, otherwise moves its contents to a new
+// block; returns NULL and keeps the old block if there is not enough memory
+void* mm_realloc(mini_malloc* sh_alloc, void* ptr, size_t size);
+
+// extends the block of memory given to init_mini_malloc from blocksize to new_blocksize bytes;
+// the additional memory has to be accessible already
+void mm_grow(mini_malloc* sh_alloc, size_t blocksize, size_t new_blocksize);
+
+// returns the size of the block that mm_allocate returns for a request of size bytes
+size_t mm_alloc_size(size_t size);
+
+// returns the usable size of a block previously allocated by mm_allocate;
+// this does not modify the allocator and can be called concurrently
+size_t mm_block_size(const void* ptr);
+
+// fills stats by walking all free blocks; the counters are kept in the mini_malloc
+// header, thus this works from every process that has the block mapped
+void mm_get_stats(mini_malloc* sh_alloc, mm_stats* stats);
+
+// checks that the nodes of the block link up and that the free ones are exactly the nodes in
+// the free lists; throws otherwise. this is used after a process died while holding the lock
+void mm_check(mini_malloc* sh_alloc);
+
 void mm_assert_all_freed(mini_malloc* sh_alloc);
 
 } // namespace structstore
@@ -8,33 +8,211 @@
 #include "structstore/stst_offsetptr.hpp"
 #include "structstore/stst_utils.hpp"
 
+#include <algorithm>
+#include <atomic>
 #include <cassert>
+#include <chrono>
 #include <cmath>
 #include <cstddef>
 #include <cstring>
 #include <functional>
+#include <limits>
 #include <sstream>
 #include <stdexcept>
+#include <string_view>
 #include <type_traits>
+#include <vector>
 
 namespace structstore {
 
 class StringStorage;
 
+// how a SharedAlloc hands out blocks, chosen at construction
+enum AllocMode {
+    // general-purpose allocation with mini_malloc, slabs and thread caches
+    MINI_MALLOC,
+    // blocks are carved off the front of the free memory without headers; deallocation is a
+    // no-op and memory is only reclaimed by resetting the whole arena. for stores which are
+    // built once and then only read
+    BUMP_POINTER
+};
+
+class ThreadCacheRegistry;
+
+// per-thread cache of recently freed small blocks, owned by one thread at a time.
+// instances of this class reside in shared memory, thus no raw pointers
+// or references should be used; use structstore::OffsetPtr<T> instead.
+struct ThreadCache {
+    // blocks of 8, 16, ..., 128 bytes are cached, one bin per size
+    static constexpr size_t BINS = 16;
+    static constexpr size_t MAX_SIZE = BINS * 8;
+    // number of blocks fetched from the arena at once when a bin is empty
+    static constexpr uint16_t REFILL_COUNT = 8;
+    // a bin with more blocks is flushed back to REFILL_COUNT blocks
+    static constexpr uint16_t MAX_COUNT = 4 * REFILL_COUNT;
+
+    // process id in the upper and pseudo thread id in the lower half, or zero
+    std::atomic_uint64_t owner{0};
+    uint16_t counts[BINS] = {};
+    // singly-linked lists of cached blocks; each block stores the next pointer
+    OffsetPtr<void, int64_t> heads[BINS];
+    // set by other threads to make the owner return its blocks on its next use of the cache,
+    // since only the owner may touch counts and heads
+    std::atomic_bool flush_requested{false};
+    uint8_t padding[23] = {};
+};
+
+static_assert(sizeof(ThreadCache) % 64 == 0);
+
+// block of equally sized small slots without per-slot headers, tracked by a bitmap.
+// instances of this class reside in shared memory, thus no raw pointers
+// or references should be used; use structstore::OffsetPtr<T> instead.
+struct Slab {
+    // the size of a slab including this header, allocated as one block from the arena
+    static constexpr size_t SIZE = 1024;
+    static constexpr size_t CLASSES = 5;
+    static constexpr uint16_t CLASS_SIZES[CLASSES] = {8, 16, 24, 32, 56};
+    static constexpr size_t MAX_SLOT_SIZE = 56;
+
+    // doubly-linked list of the slabs of one size class with free slots
+    OffsetPtr<Slab> next;
+    OffsetPtr<Slab> prev;
+    uint16_t slot_size;
+    uint16_t slot_count;
+    uint16_t used_count;
+    uint16_t size_class;
+    // bit i is set iff slot i is in use; bits of non-existing slots are always set
+    uint64_t occupied[2];
+
+    // returns the size class for the given size, or -1 if it is too big
+    static int get_class(size_t size) {
+        if (size > MAX_SLOT_SIZE) { return -1; }
+        if (size > 32) { return 4; }
+        return size == 0 ? 0 : (int) ((size - 1) / 8);
+    }
+
+    uint8_t* slots() { return (uint8_t*) this + sizeof(Slab); }
+};
+
+static_assert(sizeof(Slab) % 8 == 0);
+static_assert((Slab::SIZE - sizeof(Slab)) / Slab::CLASS_SIZES[0] <= 128);
+
 // instances of this class reside in shared memory, thus no raw pointers
 // or references should be used; use structstore::OffsetPtr<T> instead.
 class SharedAlloc {
+    friend class ThreadCacheRegistry;
+
     using byte = uint8_t;
     static constexpr size_t ALIGN = 8;
+    // one thread cache per this many bytes of arena, smaller arenas are not cached
+    static constexpr size_t THREAD_CACHE_ARENA_SIZE = 1 << 16;
+    static constexpr uint32_t MAX_THREAD_CACHES = 16;
+    // smaller arenas do not use slabs
+    static constexpr size_t SLAB_ARENA_SIZE = 16 * Slab::SIZE;
+
+public:
+    // alignments which are useful for allocate_aligned
+    static constexpr size_t CACHE_LINE_ALIGN = 64;
+    static constexpr size_t PAGE_ALIGN = 4096;
+
+    // the largest arena size supported by the compiled offset width, see STST_ARENA_64BIT
+    static constexpr size_t MAX_SIZE = std::numeric_limits<arena_diff_type>::max();
 
+    // see reallocate
+    static constexpr size_t UNKNOWN_SIZE = std::numeric_limits<size_t>::max();
+
+    // the lock of the arena, e.g. for its LockStats
+    inline const SpinMutex& get_mutex() const { return mutex; }
+
+    // called with the current arena size when a request of size bytes could not be satisfied;
+    // makes the memory behind a bigger arena accessible and returns its size, or 0 on failure
+    using GrowFn = std::function<size_t(size_t blocksize, size_t size)>;
+
+private:
     // member variables
     OffsetPtr<mini_malloc> mm;
-    SpinMutex mutex;
-    const uint32_t blocksize;
+    mutable SpinMutex mutex;
+    // grows at runtime, but only while the arena is write-locked
+    std::atomic<arena_size_type> blocksize;
     OffsetPtr<StringStorage> string_storage;
+    OffsetPtr<ThreadCache> thread_caches;
+    uint32_t thread_cache_count;
+    // for each window of Slab::SIZE bytes of the arena, the offset / 8 + 1 of the slab
+    // starting in this window, or 0; this finds the slab of a slot without a slot header
+    OffsetPtr<std::atomic_uint8_t> slab_map;
+    uint32_t slab_map_size;
+    OffsetPtr<Slab> partial_slabs[Slab::CLASSES];
+    AllocMode mode;
+    // in BUMP_POINTER mode, the offset of the free memory from the start of the arena
+    std::atomic<arena_size_type> bump_offset;
+
+    // initializes an empty arena in the block given by mm and blocksize
+    void init_arena();
+
+    // unregisters the arena from the current process without returning any blocks
+    void detach();
+
+    ThreadCache* get_thread_cache();
+
+    // returns the size of the block that allocate returns for a request of size bytes
+    size_t get_alloc_size(size_t size) const;
+
+    // returns the slab containing the given block, or nullptr; can be called concurrently
+    Slab* find_slab(const void* ptr) const;
+
+    Slab* create_slab(int size_class);
+
+    void destroy_slab(Slab* slab);
+
+    // write-locks the arena and checks it if the lock was recovered from a dead process, see
+    // SpinMutex::is_suspect
+    ScopedLock<true> lock_arena() const;
+
+    // these must be called while the arena is write-locked
+    void* allocate_locked(size_t size);
+
+    void deallocate_locked(const void* ptr);
+
+    void* allocate_block(size_t size);
+
+    void* allocate_aligned_block(size_t size, size_t alignment);
+
+    // lock-free allocation in BUMP_POINTER mode; returns nullptr if the arena is full
+    void* allocate_bump(size_t size, size_t alignment);
+
+    void refill_thread_cache(ThreadCache& cache, size_t bin);
+
+    // returns blocks of the given bin to the arena until only keep_count blocks are left
+    void flush_thread_cache(ThreadCache& cache, size_t bin, uint16_t keep_count);
+
+    void flush_thread_cache(ThreadCache& cache);
+
+    // recounts the blocks of a cache whose owner died, possibly in the middle of a push or
+    // pop, and cuts off lists which do not point into the arena
+    void repair_thread_cache(ThreadCache& cache);
+
+    // tries to grow the arena such that size more bytes can be allocated
+    bool grow(size_t size);
 
 public:
-    SharedAlloc(void* buffer, size_t size);
+    // while an instance exists, allocations of the current thread from the given arena take
+    // the free block at the lowest address which fits instead of the best fitting one, and
+    // bypass the thread cache; copying a block within such a scope moves it towards the
+    // start of the arena. blocks of slab size are not affected
+    class CompactScope {
+        const SharedAlloc* prev_alloc;
+
+    public:
+        explicit CompactScope(const SharedAlloc& sh_alloc);
+
+        ~CompactScope();
+
+        CompactScope(const CompactScope&) = delete;
+
+        CompactScope& operator=(const CompactScope&) = delete;
+    };
+
+    SharedAlloc(void* buffer, size_t size, AllocMode mode = MINI_MALLOC);
 
     ~SharedAlloc() noexcept(false);
 
@@ -55,8 +233,7 @@ public:
     template<typename T = void>
     T* allocate(size_t field_size = sizeof(T)) {
         if (field_size == 0) { field_size = ALIGN; }
-        ScopedLock<true> lock{mutex};
-        void* ptr = mm_allocate(mm.get(), field_size);
+        void* ptr = allocate_block(field_size);
         if (ptr == nullptr) {
             std::ostringstream str;
             str << "insufficient space in sh_alloc region, requested: " << field_size;
@@ -67,12 +244,70 @@ public:
         return (T*) ptr;
     }
 
-    void deallocate(const void* ptr) {
-        STST_LOG_DEBUG() << "deallocating at " << ptr;
-        ScopedLock<true> lock{mutex};
-        mm_free(mm.get(), ptr);
+    // like allocate, but the block is aligned to alignment bytes, which must be a power of two;
+    // alignments up to PAGE_ALIGN are the same in all processes, since arenas are mapped at
+    // page boundaries. such blocks do not come from slabs or thread caches
+    template<typename T = void>
+    T* allocate_aligned(size_t field_size, size_t alignment) {
+        if (field_size == 0) { field_size = ALIGN; }
+        void* ptr = allocate_aligned_block(field_size, alignment);
+        if (ptr == nullptr) {
+            std::ostringstream str;
+            str << "insufficient space in sh_alloc region, requested: " << field_size
+                << " aligned to " << alignment;
+            Callstack::throw_with_trace(str.str());
+        }
+        assert((size_t) ptr % alignment == 0);
+        STST_LOG_DEBUG() << "allocating " << typeid(T).name() << " at " << ptr;
+        return (T*) ptr;
     }
 
+    void deallocate(const void* ptr);
+
+    // resizes a block without moving it; returns false if this is not possible
+    bool resize(void* ptr, size_t size);
+
+    // resizes a block in place if possible, otherwise moves its first used_size bytes, by
+    // default all of them, to a new block; like allocate, this throws if there is not enough
+    // space. a moved block is only aligned to 8 bytes. blocks have no headers in BUMP_POINTER
+    // mode, thus used_size has to be given there
+    void* reallocate(void* ptr, size_t size, size_t used_size = UNKNOWN_SIZE);
+
+    // moves the bytes of a block into the free block at the lowest address below it which fits,
+    // and returns the new address, or ptr if there is no such block; the block must not contain
+    // offset pointers. slots of slabs are not moved
+    void* compact_block(void* ptr, size_t alignment = ALIGN);
+
+    // drops all blocks of the arena at once without running any destructors, leaving an empty
+    // arena; no other thread may use the arena concurrently
+    void reset();
+
+    // like reset, but leaves the arena unusable, such that its memory can be freed without
+    // calling the destructor
+    void discard();
+
+    // returns the blocks cached by the current thread to the arena, and makes the other
+    // threads of the current process return theirs on their next allocation or deallocation;
+    // caches of processes which have exited are returned, too
+    void flush_thread_caches();
+
+    // like flush_thread_caches, but also gives up the cache of the current thread; this has
+    // to be called before the arena is unmapped from the current process. the caches of other
+    // threads stay claimed until they use the arena again or the process exits
+    void release_thread_caches();
+
+    // sets the function used to grow the arena when it is full; this is registered for the
+    // current process only, other processes see the grown arena without further action.
+    // an empty function disables growing
+    void set_grow_fn(GrowFn grow_fn);
+
+    size_t size() const { return blocksize; }
+
+    AllocMode get_mode() const { return mode; }
+
+    // blocks in thread caches are counted as used
+    mm_stats stats() const;
+
     bool is_owned(const void* ptr) const {
         if (ptr == nullptr) {
 #ifndef NDEBUG
@@ -96,6 +331,51 @@ public:
 
 extern SharedAlloc& static_alloc;
 
+// state of a compaction pass over a tree of fields, which moves the blocks owned by the fields
+// towards the start of their arena, such that the free memory between them is merged.
+// a pass can be split into steps with a maximum duration each, so that locks are released
+// in between. blocks are handled in the order of their addresses and a step continues at the
+// address where the previous one stopped, thus fields which are inserted or removed between
+// steps do not make the pass skip or repeat blocks; a moved block only moves down, below
+// that address. each step walks the tree once to collect the addresses of the blocks, and then
+// again for each window of blocks it handles, with windows of growing size
+class Compaction {
+    using clock = std::chrono::steady_clock;
+
+    clock::time_point deadline;
+    bool unbounded;
+    // offsets are relative to this address, which has to be the same in all steps
+    const uint8_t* base;
+    // blocks below this offset were handled by the previous steps of the pass
+    size_t cursor;
+    bool collecting = true;
+    // the sorted offsets of the blocks not handled yet, while collecting
+    std::vector<size_t> offsets;
+    size_t window_begin = 0;
+    size_t window_end = 0;
+    // blocks of the current window which were not visited yet
+    size_t window_left = 0;
+
+public:
+    // a step of at most about max_pause seconds, starting at the given offset from base
+    explicit Compaction(const void* base,
+                        double max_pause = std::numeric_limits<double>::infinity(),
+                        size_t cursor = 0);
+
+    // runs the step; walk calls next for each block in the tree, and moves it if it returns
+    // true. the first window of a step is always handled, so that every step makes progress
+    void run(const std::function<void(Compaction&)>& walk);
+
+    // returns whether the block is moved in the current walk
+    bool next(const void* block);
+
+    // whether the remaining blocks of the current walk can be skipped
+    bool stopped() const { return !collecting && window_left == 0; }
+
+    // the offset for the next step to start at, or 0 if the pass is complete
+    size_t get_next_block() const { return cursor; }
+};
+
 class StructStore;
 
 template<typename T = char>
@@ -153,32 +433,342 @@ public:
 
 using shr_string = std::basic_string<char, std::char_traits<char>, StlAllocator<char>>;
 
-using shr_string_idx = uint16_t;
+using shr_string_idx = uint32_t;
 
+// vector in shared memory; when its buffer is full, it first tries to extend the buffer in
+// place, so that appending to large vectors does not copy all elements every time.
+// instances of this class reside in shared memory, thus no raw pointers
+// or references should be used; use structstore::OffsetPtr<T> instead.
 template<class T>
-using shr_vector = std::vector<T, StlAllocator<T>>;
+class shr_vector {
+    using Traits = std::allocator_traits<StlAllocator<T>>;
+
+    StlAllocator<T> alloc;
+    OffsetPtr<T, int64_t> _data;
+    size_t _size = 0;
+    size_t _capacity = 0;
+
+    void grow(size_t min_capacity) {
+        size_t new_capacity = std::max(min_capacity, 2 * _capacity);
+        SharedAlloc& sh_alloc = alloc.get_alloc();
+        if constexpr (std::is_trivially_copyable_v<T>) {
+            _data = (T*) sh_alloc.reallocate(_data.get(), new_capacity * sizeof(T),
+                                             _size * sizeof(T));
+        } else if (!_data || !sh_alloc.resize(_data.get(), new_capacity * sizeof(T))) {
+            // elements may contain offset pointers, thus they are moved one by one
+            T* new_data = alloc.allocate(new_capacity);
+            for (size_t i = 0; i < _size; ++i) {
+                Traits::construct(alloc, new_data + i, std::move(_data[i]));
+                Traits::destroy(alloc, &_data[i]);
+            }
+            if (_data) { alloc.deallocate(_data, _capacity); }
+            _data = new_data;
+        }
+        _capacity = new_capacity;
+    }
+
+public:
+    using value_type = T;
+    using iterator = T*;
+    using const_iterator = const T*;
+
+    explicit shr_vector(const StlAllocator<T>& alloc) : alloc(alloc) {}
+
+    ~shr_vector() {
+        clear();
+        if (_data) { alloc.deallocate(_data, _capacity); }
+    }
+
+    shr_vector(const shr_vector&) = delete;
+    shr_vector(shr_vector&&) = delete;
+    shr_vector& operator=(const shr_vector&) = delete;
+    shr_vector& operator=(shr_vector&&) = delete;
+
+    size_t size() const { return _size; }
+
+    size_t capacity() const { return _capacity; }
+
+    bool empty() const { return _size == 0; }
+
+    T* data() { return _data.get(); }
+
+    const T* data() const { return _data.get(); }
+
+    iterator begin() { return _data.get(); }
+
+    iterator end() { return _data.get() + _size; }
+
+    const_iterator begin() const { return _data.get(); }
+
+    const_iterator end() const { return _data.get() + _size; }
+
+    T& operator[](size_t index) { return _data[index]; }
+
+    const T& operator[](size_t index) const { return _data[index]; }
+
+    T& at(size_t index) {
+        if (index >= _size) {
+            throw std::out_of_range("index out of bounds: " + std::to_string(index));
+        }
+        return _data[index];
+    }
+
+    const T& at(size_t index) const { return ((shr_vector&) *this).at(index); }
+
+    void reserve(size_t capacity) {
+        if (capacity > _capacity) { grow(capacity); }
+    }
+
+    template<typename... Args>
+    T& emplace_back(Args&&... args) {
+        if (_size == _capacity) { grow(_size + 1); }
+        Traits::construct(alloc, _data.get() + _size, std::forward<Args>(args)...);
+        return _data[_size++];
+    }
+
+    void push_back(const T& value) { emplace_back(value); }
+
+    void push_back(T&& value) { emplace_back(std::move(value)); }
+
+    template<typename... Args>
+    iterator emplace(const_iterator pos, Args&&... args) {
+        size_t index = pos - begin();
+        emplace_back(std::forward<Args>(args)...);
+        std::rotate(begin() + index, end() - 1, end());
+        return begin() + index;
+    }
+
+    iterator erase(const_iterator pos) {
+        size_t index = pos - begin();
+        std::move(begin() + index + 1, end(), begin() + index);
+        Traits::destroy(alloc, &_data[--_size]);
+        return begin() + index;
+    }
+
+    void clear() {
+        for (size_t i = 0; i < _size; ++i) { Traits::destroy(alloc, &_data[i]); }
+        _size = 0;
+    }
+
+    bool operator==(const shr_vector& other) const {
+        return _size == other._size && std::equal(begin(), end(), other.begin());
+    }
+
+    bool operator!=(const shr_vector& other) const { return !(*this == other); }
+
+    // moves the buffer towards the start of the arena if there is a free block further down,
+    // see SharedAlloc::compact_block
+    void compact() {
+        if (!_data) { return; }
+        SharedAlloc& sh_alloc = alloc.get_alloc();
+        if constexpr (std::is_trivially_copyable_v<T>) {
+            _data = (T*) sh_alloc.compact_block(_data.get());
+        } else {
+            SharedAlloc::CompactScope scope{sh_alloc};
+            T* new_data = alloc.allocate(_capacity);
+            if (new_data > _data.get()) {
+                alloc.deallocate(new_data, _capacity);
+                return;
+            }
+            for (size_t i = 0; i < _size; ++i) {
+                Traits::construct(alloc, new_data + i, std::move(_data[i]));
+                Traits::destroy(alloc, &_data[i]);
+            }
+            alloc.deallocate(_data, _capacity);
+            _data = new_data;
+        }
+    }
+};
 
 template<class K, class T, class H = ankerl::unordered_dense::hash<K>>
 using shr_unordered_map = ankerl::unordered_dense::map<K, T, H, std::equal_to<K>,
                                                        StlAllocator<std::pair<const K, T>>>;
 
+// table of interned strings such as field names, which are referred to by their index; index 0
+// is the empty string and means "not found". strings are only appended and never move while
+// they are referenced, thus lookups take no lock and allocate nothing, only inserting a new
+// string takes the lock. strings are reference-counted by the FieldMaps using them; unused ones
+// are dropped by reclaim, which makes their indices available again.
 // instances of this class reside in shared memory, thus no raw pointers
 // or references should be used; use structstore::OffsetPtr<T> instead.
 class StringStorage {
-    shr_unordered_map<shr_string, shr_string_idx> map;
-    shr_vector<shr_string> data;
+    struct Entry {
+        shr_string str;
+        uint32_t hash;
+        // references by FieldMaps, or FREE if this entry is unused
+        std::atomic_uint32_t refs;
+        // for unused entries, the next unused one, or 0
+        shr_string_idx next_free;
+    };
+
+    static constexpr uint32_t FREE = std::numeric_limits<uint32_t>::max();
+    // chunk i holds FIRST_CHUNK_SIZE << i entries
+    static constexpr size_t FIRST_CHUNK_SIZE = 8;
+    static constexpr size_t CHUNKS = 30;
+    static_assert(FIRST_CHUNK_SIZE * ((UINT64_C(1) << CHUNKS) - 1) >=
+                  (uint64_t) std::numeric_limits<shr_string_idx>::max());
+
+    // open-addressing hash table, each slot holds the hash of a string in the upper and its
+    // index in the lower half, zero if the slot is empty, or TOMBSTONE if its string was
+    // dropped. a full table is replaced by a new one; the old one is kept until the next
+    // reclaim, since readers might still probe it
+    struct Table {
+        static constexpr uint64_t TOMBSTONE = std::numeric_limits<uint64_t>::max();
+
+        OffsetPtr<Table> prev;
+        uint64_t mask;
+        // number of slots which are not empty
+        uint64_t used;
+
+        std::atomic_uint64_t* slots() { return (std::atomic_uint64_t*) (this + 1); }
+    };
+
+    OffsetPtr<SharedAlloc> sh_alloc;
+    OffsetPtr<Entry> chunks[CHUNKS];
+    // number of entries including the unused ones
+    std::atomic_uint32_t count{0};
+    // number of entries in use, including entry 0
+    uint32_t live_count = 0;
+    shr_string_idx first_free = 0;
+    // changes whenever an index might refer to a different string than before, i.e. when
+    // strings are dropped; starts at a random value, so that a storage created at the same
+    // address as a previous one does not match indices cached by FieldKeys
+    std::atomic_uint32_t generation;
+    // offset of the current table from this object
+    std::atomic_int64_t table_offset{0};
     mutable SpinMutex mutex;
 
+    Table* get_table() const {
+        return (Table*) ((uint8_t*) this + table_offset.load(std::memory_order_acquire));
+    }
+
+    // replaces the current table by a new one holding all strings in use
+    void rebuild_table();
+
+    static void insert_slot(Table& table, uint32_t hash, shr_string_idx idx);
+
+    Entry& get_entry(shr_string_idx idx) const;
+
+    // like get_entry, but creates the chunk of the entry if needed
+    Entry& create_entry(shr_string_idx idx);
+
+public:
+    explicit StringStorage(SharedAlloc& sh_alloc);
+
+    ~StringStorage();
+
+    StringStorage(const StringStorage&) = delete;
+
+    StringStorage& operator=(const StringStorage&) = delete;
+
+    // FNV-1a, which is the same in all processes; can be used to precompute the hash of
+    // names known at compile time
+    static constexpr uint32_t hash(std::string_view str) {
+        uint32_t h = 0x811C9DC5ul;
+        for (char c: str) { h = (h ^ (uint8_t) c) * 0x01000193ul; }
+        return h;
+    }
+
+    // returns the index of the given string, inserting it if needed, and takes a reference
+    // to it, which has to be given back with release
+    shr_string_idx internalize(std::string_view str);
+
+    void release(shr_string_idx idx);
+
+    // drops all strings without references, whose indices are then reused by internalize,
+    // and frees replaced tables; returns the number of dropped strings. no other thread may
+    // use this storage meanwhile, e.g. by holding a write lock on the store owning the arena
+    size_t reclaim();
+
+    // returns the index of the given string, or 0 if it has not been internalized;
+    // this is wait-free and does not allocate
+    shr_string_idx get_idx(std::string_view str, uint32_t hash) const;
+
+    inline shr_string_idx get_idx(std::string_view str) const { return get_idx(str, hash(str)); }
+
+    const shr_string* get(shr_string_idx idx) const { return &get_entry(idx).str; }
+
+    inline uint32_t get_generation() const {
+        return generation.load(std::memory_order_acquire);
+    }
+
+    // number of strings in use, including the empty one
+    size_t size() const { return live_count; }
+
+    inline const SpinMutex& get_mutex() const { return mutex; }
+};
+
+// name of a field known at compile time, with its hash computed at compile time. the index of
+// the name is cached for the few StringStorages it was last used with, e.g. the root arena and
+// some sub-arenas, so that repeated accesses neither hash nor look up the name. keys used with
+// more storages in turn fall back to the lookup. keys have to outlive their uses, e.g. as
+// static objects; see STST_KEY
+class FieldKey {
+    // cached tag while it is being written
+    static constexpr uint64_t BUSY = std::numeric_limits<uint64_t>::max();
+    static constexpr size_t CACHE_SIZE = 4;
+
+    struct CacheEntry {
+        // the generation of strings in the upper and the index of the name in it in the lower
+        // half, or zero if nothing is cached
+        std::atomic_uint64_t tag{0};
+        std::atomic<const StringStorage*> strings{nullptr};
+    };
+
+    std::string_view name;
+    uint32_t hash;
+    mutable CacheEntry cache[CACHE_SIZE];
+    // the entry which is replaced next, unless the storage has one already
+    mutable std::atomic_uint32_t next_entry{0};
+
 public:
-    StringStorage(SharedAlloc& sh_alloc);
+    constexpr explicit FieldKey(std::string_view name)
+        : name{name}, hash{StringStorage::hash(name)} {}
+
+    FieldKey(const FieldKey&) = delete;
 
-    shr_string_idx internalize(const std::string& str, SharedAlloc& sh_alloc);
+    FieldKey& operator=(const FieldKey&) = delete;
 
-    shr_string_idx get_idx(const std::string& str, SharedAlloc& sh_alloc) const;
+    inline std::string_view get_name() const { return name; }
 
-    const shr_string* get(shr_string_idx idx) const;
+    inline uint32_t get_hash() const { return hash; }
+
+    // returns the index of the name in the given storage, or 0 if it has not been internalized
+    shr_string_idx get_idx(const StringStorage& strings) const {
+        uint64_t generation = strings.get_generation();
+        CacheEntry* victim = nullptr;
+        for (CacheEntry& entry: cache) {
+            uint64_t tag = entry.tag.load(std::memory_order_acquire);
+            if (entry.strings.load(std::memory_order_acquire) != &strings) { continue; }
+            if ((tag >> 32) == generation && tag != 0 && tag != BUSY &&
+                entry.tag.load(std::memory_order_relaxed) == tag) {
+                return (shr_string_idx) tag;
+            }
+            victim = &entry;
+        }
+        shr_string_idx idx = strings.get_idx(name, hash);
+        if (idx == 0) { return 0; }
+        if (!victim) {
+            victim = &cache[next_entry.fetch_add(1, std::memory_order_relaxed) % CACHE_SIZE];
+        }
+        // only one thread updates an entry at a time, the others just skip it
+        uint64_t tag = victim->tag.load(std::memory_order_relaxed);
+        if (tag != BUSY &&
+            victim->tag.compare_exchange_strong(tag, BUSY, std::memory_order_acquire)) {
+            victim->strings.store(&strings, std::memory_order_release);
+            victim->tag.store((generation << 32) | idx, std::memory_order_release);
+        }
+        return idx;
+    }
 };
 
+// a reference to a static FieldKey for the given string literal, e.g. store[STST_KEY("num")]
+#define STST_KEY(name)                                                                             \
+    ([]() -> const ::structstore::FieldKey& {                                                      \
+        static const ::structstore::FieldKey key{name};                                            \
+        return key;                                                                                \
+    }())
+
 } // namespace structstore
 
 #endif
@@ -22,6 +22,8 @@ public:
 
     void check(const SharedAlloc* sh_alloc = nullptr) const;
 
+    void compact(Compaction& compaction);
+
     String& operator=(const std::string& value);
 };
 
@@ -151,6 +153,12 @@ public:
 
     void check(const SharedAlloc* sh_alloc = nullptr) const;
 
+    void compact(Compaction& compaction);
+
+    void collect_lock_stats(LockStatsCollector& collector) const;
+
+    size_t reclaim_names();
+
     bool operator==(const List& other) const;
 };
 
@@ -167,6 +175,7 @@ protected:
     size_t _ndim;
     size_t _shape[MAX_DIMS] = {};
     OffsetPtr<double> _data;
+    size_t _alignment = SharedAlloc::CACHE_LINE_ALIGN;
 
 public:
     Matrix(SharedAlloc& sh_alloc) : Matrix(0, 0, sh_alloc) {}
@@ -194,6 +203,7 @@ public:
         std::swap(_ndim, other._ndim);
         std::swap(_shape, other._shape);
         std::swap(_data, other._data);
+        std::swap(_alignment, other._alignment);
         return *this;
     }
 
@@ -208,8 +218,28 @@ public:
 
     double* data() { return _data.get(); }
 
+    size_t alignment() const { return _alignment; }
+
+    // sets the alignment of the data, which is a cache line by default; large buffers
+    // can use SharedAlloc::PAGE_ALIGN. existing data is moved if it is not aligned yet
+    void set_alignment(size_t alignment) {
+        if (alignment == 0 || (alignment & (alignment - 1)) != 0 ||
+            alignment > SharedAlloc::PAGE_ALIGN) {
+            throw std::runtime_error("matrix alignment has to be a power of two up to a page");
+        }
+        _alignment = alignment;
+        if (_data && (size_t) _data.get() % alignment != 0) {
+            size_t size = sizeof(double);
+            for (size_t i = 0; i < _ndim; ++i) { size *= _shape[i]; }
+            double* data = sh_alloc->allocate_aligned<double>(size, alignment);
+            std::memcpy(data, _data.get(), size);
+            sh_alloc->deallocate(_data.get());
+            _data = data;
+        }
+    }
+
     void from(size_t ndim, const size_t* shape, const double* data) {
-        if (data == _data.get()) {
+        if (data != nullptr && data == _data.get()) {
             if (ndim != _ndim) {
                 throw std::runtime_error("setting matrix data to same pointer but different size");
             }
@@ -234,7 +264,7 @@ public:
             size *= shape[i];
         }
         if (size > 0) {
-            _data = (double*) sh_alloc->allocate(size);
+            _data = sh_alloc->allocate_aligned<double>(size, _alignment);
             if (data != nullptr) { std::memcpy(_data.get(), data, size); }
         }
     }
@@ -245,6 +275,8 @@ public:
 
     void check(const SharedAlloc* sh_alloc = nullptr) const;
 
+    void compact(Compaction& compaction);
+
     bool operator==(const Matrix& other) const;
 };
 }
@@ -12,6 +12,8 @@
 
 namespace structstore {
 
+class FieldMapBase;
+
 template<bool managed>
 class FieldMap;
 
@@ -194,6 +196,18 @@ public:
         view().check(sh_alloc, parent_field);
     }
 
+    inline void compact(Compaction& compaction) {
+        if (data) { typing::get_type(type_hash).compact_fn(data.get(), compaction); }
+    }
+
+    inline void collect_lock_stats(LockStatsCollector& collector) const {
+        if (data) { typing::get_type(type_hash).collect_lock_stats_fn(data.get(), collector); }
+    }
+
+    inline size_t reclaim_names() {
+        return data ? typing::get_type(type_hash).reclaim_names_fn(data.get()) : 0;
+    }
+
     inline bool operator==(const Field& other) const { return view() == other.view(); }
 
     inline bool operator!=(const Field& other) const { return !(*this == other); }
@@ -234,12 +248,15 @@ class FieldAccess {
     Field& field;
     SharedAlloc& sh_alloc;
     const FieldTypeBase* parent_field;
+    // the map containing the field, if any
+    FieldMapBase* field_map;
 
 public:
     FieldAccess() = delete;
 
-    explicit FieldAccess(Field& field, SharedAlloc& sh_alloc, const FieldTypeBase* parent_field)
-        : field(field), sh_alloc(sh_alloc), parent_field(parent_field) {}
+    explicit FieldAccess(Field& field, SharedAlloc& sh_alloc, const FieldTypeBase* parent_field,
+                         FieldMapBase* field_map = nullptr)
+        : field(field), sh_alloc(sh_alloc), parent_field(parent_field), field_map(field_map) {}
 
     FieldAccess(const FieldAccess& other) = default;
 
@@ -264,12 +281,16 @@ public:
 
     FieldAccess<true> operator[](const std::string& name) { return get<StructStore>()[name]; }
 
+    FieldAccess<true> operator[](const FieldKey& key) { return get<StructStore>()[key]; }
+
     FieldAccess<true> operator[](size_t idx) { return get<List>()[idx]; }
 
-    operator FieldAccess<false>() { return FieldAccess<false>{field, sh_alloc, parent_field}; }
+    operator FieldAccess<false>() {
+        return FieldAccess<false>{field, sh_alloc, parent_field, field_map};
+    }
 
     FieldAccess<true> to_managed_access() {
-        return FieldAccess<true>{field, sh_alloc, parent_field};
+        return FieldAccess<true>{field, sh_alloc, parent_field, field_map};
     }
 
     template<typename T>
@@ -295,7 +316,7 @@ public:
 
     [[nodiscard]] type_hash_t get_type_hash() const { return field.get_type_hash(); }
 
-    void clear() { field.clear(sh_alloc); }
+    void clear();
 };
 
 // this class resides in local stack or heap memory;
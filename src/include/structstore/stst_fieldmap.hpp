@@ -20,17 +20,24 @@ class FieldMapBase {
 protected:
     OffsetPtr<SharedAlloc> sh_alloc;
     shr_unordered_map<shr_string_idx, Field> fields;
+    // each name in slots holds a reference to its string in the StringStorage
     shr_vector<shr_string_idx> slots;
+    // incremented whenever the data of existing fields is destroyed, see FieldHandle
+    uint64_t generation;
 
     // constructor, assignment, destructor
 
-    explicit FieldMapBase(SharedAlloc& sh_alloc)
+    explicit FieldMapBase(SharedAlloc& sh_alloc, uint64_t generation)
         : sh_alloc(&sh_alloc), fields(0, StlAllocator<>(sh_alloc)),
-          slots(StlAllocator<>(sh_alloc)) {
+          slots(StlAllocator<>(sh_alloc)), generation(generation) {
         STST_LOG_DEBUG() << "constructing FieldMap at " << this << " with alloc at " << &sh_alloc
                          << " (static alloc: " << (&sh_alloc == &static_alloc) << ")";
     }
 
+    void release_names() {
+        for (shr_string_idx name_idx: slots) { sh_alloc->strings().release(name_idx); }
+    }
+
 public:
     // FieldTypeBase utility functions
 
@@ -40,6 +47,14 @@ public:
 
     void check(const SharedAlloc* sh_alloc, const FieldTypeBase& parent_field) const;
 
+    void compact(Compaction& compaction);
+
+    // adds the stats of the locks of the fields, under their names
+    void collect_lock_stats(LockStatsCollector& collector) const;
+
+    // drops the unused names of the sub-arenas below the fields
+    size_t reclaim_names();
+
     bool equal_slots(const FieldMapBase& other) const;
 
     bool operator==(const FieldMapBase& other) const;
@@ -56,16 +71,31 @@ public:
 
     inline const shr_vector<shr_string_idx>& get_slots() const { return slots; }
 
+    inline uint64_t get_generation() const { return generation; }
+
+    // to be called when the data of a field is destroyed without removing the field
+    inline void invalidate_handles() { ++generation; }
+
     Field* try_get_field(const std::string& name);
 
     const Field* try_get_field(const std::string& name) const;
 
+    Field* try_get_field(const FieldKey& key);
+
+    const Field* try_get_field(const FieldKey& key) const;
+
     inline Field& at(const std::string& name) {
-        return fields.at(sh_alloc->strings().get_idx(name, *sh_alloc));
+        return fields.at(sh_alloc->strings().get_idx(name));
     }
 
     inline const Field& at(const std::string& name) const {
-        return fields.at(sh_alloc->strings().get_idx(name, *sh_alloc));
+        return fields.at(sh_alloc->strings().get_idx(name));
+    }
+
+    inline Field& at(const FieldKey& key) { return fields.at(key.get_idx(sh_alloc->strings())); }
+
+    inline const Field& at(const FieldKey& key) const {
+        return fields.at(key.get_idx(sh_alloc->strings()));
     }
 
     inline Field& at(shr_string_idx name_idx) { return fields.at(name_idx); }
@@ -84,12 +114,15 @@ protected:
 
     void copy_from_managed(const FieldMap& other, const FieldTypeBase* parent_field);
 
-    Field& get_or_insert(const std::string& name);
+    Field& get_or_insert(std::string_view name);
+
+    Field& get_or_insert(const FieldKey& key);
 
 public:
     // constructor, assignment, destructor
 
-    explicit FieldMap(SharedAlloc& sh_alloc) : FieldMapBase(sh_alloc) {}
+    explicit FieldMap(SharedAlloc& sh_alloc, uint64_t generation = 0)
+        : FieldMapBase(sh_alloc, generation) {}
 
     FieldMap(const FieldMap& other) : FieldMap{static_alloc} { *this = other; }
 
@@ -124,6 +157,12 @@ public:
         return get_or_insert(name);
     }
 
+    inline Field& operator[](const FieldKey& key) {
+        static_assert(managed, "potentially creating fields in unmanaged FieldMap is not supported "
+                               "(use .at() instead)");
+        return get_or_insert(key);
+    }
+
     template<typename T>
     void store_ref(const std::string& name, T& t, const FieldTypeBase& parent_field) {
         static_assert(!managed, "storing ref in managed FieldMap is not supported");
@@ -138,9 +177,12 @@ public:
         STST_LOG_DEBUG() << "registering unmanaged data at " << &t << "in FieldMap at " << this
                          << " with alloc at " << &sh_alloc
                          << " (static alloc: " << (sh_alloc.get() == &static_alloc) << ")";
-        shr_string_idx name_idx = sh_alloc->strings().internalize(name, *sh_alloc);
+        shr_string_idx name_idx = sh_alloc->strings().internalize(name);
         auto [it, inserted] = fields.emplace(name_idx, Field{});
-        if (!inserted) { throw std::runtime_error("field name already exists"); }
+        if (!inserted) {
+            sh_alloc->strings().release(name_idx);
+            throw std::runtime_error("field name already exists");
+        }
         it->second.set_data(&t);
         slots.emplace_back(name_idx);
         STST_LOG_DEBUG() << "field " << name << " at " << &t;
@@ -156,6 +198,8 @@ public:
         STST_LOG_DEBUG() << "clearing FieldMap at " << this << "with alloc at " << &sh_alloc;
         if (sh_alloc.get() == &static_alloc) STST_LOG_DEBUG() << "(this is using the static_alloc)";
         for (auto& [key, value]: fields) { value.clear(*sh_alloc); }
+        invalidate_handles();
+        release_names();
         fields.clear();
         slots.clear();
     }
@@ -165,18 +209,21 @@ public:
         STST_LOG_DEBUG() << "clearing FieldMap at " << this << "with alloc at " << &sh_alloc;
         if (sh_alloc.get() == &static_alloc) STST_LOG_DEBUG() << "(this is using the static_alloc)";
         for (auto& [key, value]: fields) { value.clear_unmanaged(); }
+        release_names();
         fields.clear();
         slots.clear();
     }
 
     void remove(const std::string& name) {
         static_assert(managed, "removing fields from unmanaged FieldMap is not supported");
-        shr_string_idx name_idx = sh_alloc->strings().get_idx(name, *sh_alloc);
+        shr_string_idx name_idx = sh_alloc->strings().get_idx(name);
         Field& field = fields.at(name_idx);
         field.clear(*sh_alloc);
+        invalidate_handles();
         fields.erase(name_idx);
         auto slot_it = std::find(slots.begin(), slots.end(), name_idx);
         slots.erase(slot_it);
+        sh_alloc->strings().release(name_idx);
     }
 };
 
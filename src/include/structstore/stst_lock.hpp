@@ -1,25 +1,236 @@
 #ifndef STST_LOCK_HPP
 #define STST_LOCK_HPP
 
+#include "structstore/stst_offsetptr.hpp"
+
 #include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <limits>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
 
 namespace structstore {
 
+class FieldTypeBase;
+
+// the time until which a lock acquisition waits. timeouts are given in seconds; a negative
+// timeout waits forever and zero fails at once if the lock is taken
+class LockDeadline {
+    using clock = std::chrono::steady_clock;
+
+    // for looking up the timeout of the store containing this field, or nullptr
+    const FieldTypeBase* field;
+    double timeout;
+    bool started = false;
+    clock::time_point deadline{};
+
+public:
+    static constexpr double FOREVER = -1.0;
+    // used unless another timeout is given or set for the store
+    static constexpr double DEFAULT_TIMEOUT = 0.1;
+
+    explicit LockDeadline(double timeout) : field{nullptr}, timeout{timeout} {}
+
+    // uses the timeout set for the store containing the field, see set_store_timeout
+    explicit LockDeadline(const FieldTypeBase& field)
+        : field{&field}, timeout{DEFAULT_TIMEOUT} {}
+
+    // starts the deadline on the first call, which is only done once the lock turned out to
+    // be taken; returns false if the deadline has passed
+    bool check();
+
+    // nanoseconds until the deadline, or -1 if waiting forever
+    int64_t remaining_nsecs() const;
+
+    // sets the timeout for locking fields below the given root field in this process
+    static void set_store_timeout(const FieldTypeBase& root, double timeout);
+
+    static void reset_store_timeout(const FieldTypeBase& root);
+
+    // returns the timeout for locking the given field in this process
+    static double get_store_timeout(const FieldTypeBase& field);
+};
+
+// counts the threads reading fields below a SpinMutex in several cache lines instead of its
+// state, such that readers on different cores do not contend for one cache line; writers wait
+// until all slots are empty. instances of this class reside in shared memory
+class ReaderSlots {
+    friend class SpinMutex;
+    friend class LockJournal;
+
+public:
+    static constexpr uint32_t COUNT = 16;
+
+private:
+    struct Slot {
+        std::atomic_int32_t readers{0};
+        // the counters of two slots never share a cache line
+        uint8_t padding[60];
+    };
+
+    static_assert(sizeof(Slot) == 64);
+
+    Slot slots[COUNT];
+
+    inline Slot& get(uint32_t tid) { return slots[tid % COUNT]; }
+};
+
+// what happened to a SpinMutex in this process since instrumentation was enabled, see
+// SpinMutex::set_instrumentation; intention locks count as acquisitions, but not for hold times
+struct LockStats {
+    uint64_t acquisitions = 0;
+    // attempts which found the lock taken, and those which failed at the deadline
+    uint64_t contended = 0;
+    uint64_t timeouts = 0;
+    // busy-wait iterations before acquiring the lock or giving up
+    uint64_t spins = 0;
+    uint64_t wait_nsecs = 0;
+    // the longest time a read or write lock was held, and the pseudo thread id of its holder
+    uint64_t max_hold_nsecs = 0;
+    uint32_t max_hold_tid = 0;
+    // the pseudo thread id of the thread which holds the write lock now, or zero
+    uint32_t holder_tid = 0;
+};
+
 // instances of this class reside in shared memory, thus no raw pointers
 // or references should be used; use structstore::OffsetPtr<T> instead.
 class SpinMutex {
     template<bool write>
     friend class ScopedLock;
+    friend class LockJournal;
 
     friend class FieldTypeBase;
+    friend class LockWaiter;
+    friend class StructStore;
+
+public:
+    // how a thread waits for a lock after spinning for a while
+    enum WaitMode {
+        // yield the CPU in a loop
+        YIELD,
+        // sleep on a futex until the lock is released
+        FUTEX
+    };
+
+private:
+    // the lower half of state is also the futex word, thus it holds everything whose change
+    // has to wake sleeping threads: the lowest 15 bits are the level: >0 is read-locked, 0 is
+    // unlocked, <0 is write-locked; more than 16383 readers would overflow it
+    static constexpr uint64_t LEVEL_MASK = 0x7fff;
+    // set if threads might sleep until a count in the state drops to zero
+    static constexpr uint64_t WAITERS = 1ull << 15;
+    // the version of the protected data, incremented by each write lock, see read_version. it
+    // wraps around after 65536 write locks, an optimistic reader which is preempted meanwhile
+    // might thus miss a change
+    static constexpr uint64_t VERSION_MASK = 0xffff0000;
+    static constexpr uint64_t VERSION_ONE = 0x10000;
+    // the number of threads holding the lock with the intention to read or write fields below;
+    // these are compatible with each other, and with readers only for intention readers. each
+    // count takes 14 bits, i.e. up to 16383 threads
+    static constexpr uint64_t INTENT_READ_ONE = 1ull << 32;
+    static constexpr uint64_t INTENT_READ_MASK = 0x3fffull << 32;
+    static constexpr uint64_t INTENT_WRITE_ONE = 1ull << 46;
+    static constexpr uint64_t INTENT_WRITE_MASK = 0x3fffull << 46;
+    // set when the lock was taken over from a process which died while holding it, until the
+    // protected data has been checked, see is_suspect
+    static constexpr uint64_t SUSPECT = 1ull << 60;
+    // set by a waiting writer which prefers to get the lock before new readers, see
+    // set_writer_preference
+    static constexpr uint64_t WRITER_PENDING = 1ull << 61;
+    // set if intention readers are counted in ReaderSlots instead of the state, see
+    // make_scalable
+    static constexpr uint64_t SCALABLE = 1ull << 62;
+    // the counts of all threads holding the lock in any mode
+    static constexpr uint64_t HELD_MASK = LEVEL_MASK | INTENT_READ_MASK | INTENT_WRITE_MASK;
+    // the owner token holds the process id in its upper bits and the lowest bits of the start
+    // time of the process in the others, such that a reused process id does not match it
+    static constexpr uint32_t START_TIME_BITS = 10;
+
+public:
+    // returned by read_version if another thread holds the write lock
+    static constexpr uint32_t NO_VERSION = std::numeric_limits<uint32_t>::max();
+
+private:
 
     // randomly assigned pseudo thread id
     static thread_local uint32_t tid;
 
+    static std::atomic<WaitMode> wait_mode;
+
+    static std::atomic_bool writer_preference;
+
+    static std::atomic_uint64_t recoveries;
+
+    // resets the thread id and the owner token in a forked child
+    static bool fork_handler;
+
+    static void after_fork();
+
+    // its lower half, which contains WAITERS, is also the futex word, which is shared between
+    // processes
+    std::atomic_uint64_t state{0};
     // thread id currently holding the write lock, or zero
     uint32_t write_lock_tid{0};
-    // >0 is read-locked, 0 is unlocked, <0 is write-locked
-    std::atomic_int16_t level{0};
+    // owner token of the process currently holding the write lock, or zero, see owner_token
+    std::atomic_uint32_t write_lock_owner{0};
+
+    static inline int16_t get_level(uint64_t s) {
+        // sign-extends the 15 bits of the level
+        return (int16_t) ((uint16_t) (s << 1)) >> 1;
+    }
+
+    // whether a pending writer blocks threads which do not hold the lock yet; this is also the
+    // case right after the last holder released the lock, until the writer got it, otherwise
+    // the releasing reader would take the lock again first
+    static inline bool blocked_by_writer(uint64_t s) { return s & WRITER_PENDING; }
+
+    static inline uint64_t with_level(uint64_t s, int16_t level) {
+        return (s & ~LEVEL_MASK) | ((uint16_t) level & LEVEL_MASK);
+    }
+
+    inline uint32_t* futex_word() {
+#if __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+        return reinterpret_cast<uint32_t*>(&state) + 1;
+#else
+        return reinterpret_cast<uint32_t*>(&state);
+#endif
+    }
+
+    // sets the level, which is not changed concurrently by other threads, and wakes up
+    // sleeping threads when the lock is released
+    void set_level(int16_t level);
+
+    // waits until no other thread holds the write lock and the bits of blocking in the state
+    // equal own, which this thread holds, then adds one to the state. unless owned is set, i.e.
+    // this thread holds the lock in some mode already, it also waits for pending writers
+    bool try_add(LockDeadline& deadline, uint64_t one, uint64_t blocking, uint64_t own,
+                 bool owned);
+
+    // clears WRITER_PENDING after a writer gave up, which wakes the threads waiting for it;
+    // other waiting writers set it again
+    void clear_writer_pending();
+
+    // the owner token of the current process
+    static uint32_t owner_token();
+
+    // returns true if the process with the given owner token has exited
+    static bool is_owner_dead(uint32_t owner);
+
+    // takes over the write lock from the dead process with the given owner token, marks the
+    // lock as suspect and releases it; returns false if another thread was faster
+    bool recover(uint32_t owner);
+
+    // subtracts one from the count in mask and wakes up sleeping threads if it dropped to zero
+    void release(uint64_t one, uint64_t mask);
+
+    void wake_waiters();
+
+    // record the start and the end of holding a read or write lock if instrumentation is enabled
+    void hold_started() const;
+    void hold_ended() const;
 
     SpinMutex(SpinMutex&&) = delete;
 
@@ -29,17 +240,205 @@ class SpinMutex {
 
     SpinMutex& operator=(const SpinMutex&) = delete;
 
+    // these return false if the lock could not be acquired before the deadline. own_intent_write
+    // is set if this thread holds the lock with the intention to write fields below, which then
+    // does not prevent reading; owned is set if it holds the lock in any mode, which pending
+    // writers then wait for. slots are the reader slots of a scalable lock
+    bool try_read_lock(LockDeadline& deadline, bool own_intent_write = false,
+                       bool owned = false);
+    bool try_write_lock(LockDeadline& deadline, ReaderSlots* slots = nullptr);
+
+    // these throw if the lock could not be acquired within LockDeadline::DEFAULT_TIMEOUT
     void read_lock();
     void read_unlock();
 
     void write_lock();
     void write_unlock();
 
-    void read_or_write_lock();
-    void read_or_write_unlock();
+    // locks with the intention to read or write fields below, which only conflicts with readers
+    // and writers of the whole field; own_read is set if this thread holds the read lock, which
+    // then does not prevent writing below, and owned as for try_read_lock. the slots have to be
+    // the same for unlocking
+    bool try_intention_lock(bool write, LockDeadline& deadline, ReaderSlots* slots, bool own_read,
+                            bool owned);
+    void intention_unlock(bool write, ReaderSlots* slots);
+
+    // from now on, intention readers passing reader slots are counted there and do not write to
+    // the state; this thread has to hold the write lock
+    inline void make_scalable() { state.fetch_or(SCALABLE, std::memory_order_relaxed); }
+
+    inline void reset_scalable() { state.fetch_and(~SCALABLE, std::memory_order_relaxed); }
+
+    inline bool is_scalable() const { return state.load(std::memory_order_relaxed) & SCALABLE; }
+
+    // for optimistic reads, which do not write to the lock: returns the version of the
+    // protected data, or NO_VERSION if another thread holds the write lock
+    inline uint32_t read_version() const {
+        uint64_t s = state.load(std::memory_order_acquire);
+        if (get_level(s) < 0 && write_lock_tid != tid) { return NO_VERSION; }
+        return (uint32_t) (s & VERSION_MASK);
+    }
+
+    // returns true if the protected data has not been written since read_version returned
+    // the given version; reads of the data before this call cannot be reordered after it
+    inline bool check_version(uint32_t version) const {
+        std::atomic_thread_fence(std::memory_order_acquire);
+        return read_version() == version;
+    }
 
 public:
     SpinMutex() = default;
+
+    // sets how threads of this process wait for locks, FUTEX by default. processes with
+    // different modes can share locks
+    static void set_wait_mode(WaitMode mode);
+
+    // lets writers of this process which have to wait for a lock block new readers of it, also
+    // those of other processes, such that continuous readers do not starve them; readers and
+    // writers which hold the lock in some mode already are not blocked. this is disabled by
+    // default, since threads which read several fields at once might wait for each other's
+    // writers then, until one of them times out
+    static void set_writer_preference(bool enabled);
+
+    // records lock acquisitions of this process in a table on the side, see get_stats; this
+    // costs a lookup in the table for each acquisition, thus it is disabled by default
+    static void set_instrumentation(bool enabled);
+
+    static bool is_instrumented();
+
+    // while an instance exists, the locks of the current thread are not recorded by the
+    // instrumentation, e.g. those taken for collecting the stats
+    class Untracked {
+        bool prev;
+
+    public:
+        Untracked();
+        ~Untracked();
+
+        Untracked(const Untracked&) = delete;
+        Untracked& operator=(const Untracked&) = delete;
+    };
+
+    // drops the stats of all locks
+    static void reset_stats();
+
+    // returns false if nothing was recorded for this lock
+    bool get_stats(LockStats& stats) const;
+
+    // the pseudo thread id of the current thread, as recorded in LockStats
+    static inline uint32_t get_tid() { return tid; }
+
+    // a thread waiting for a write lock held by a process which has died takes the lock over;
+    // the lock is then suspect until the data it protects has been checked. the read and
+    // intention locks of dead processes are released by LockJournal
+    inline bool is_suspect() const { return state.load(std::memory_order_acquire) & SUSPECT; }
+
+    inline void clear_suspect() { state.fetch_and(~SUSPECT, std::memory_order_release); }
+
+    // the number of locks which threads of this process took over from dead processes
+    static uint64_t get_recoveries();
+};
+
+static_assert(sizeof(SpinMutex) == 16);
+
+// records the read and intention locks which the threads of the processes using a shared
+// segment hold on its fields, such that a thread waiting for them can release those of a
+// process which died; write locks record their owner in the lock itself. each thread claims a
+// block of entries on its first lock in the segment; the locks of further threads, and those
+// beyond the entries of a block, are not recorded. a lock is recorded after acquiring it and
+// dropped before releasing it, thus a process dying in between leaks it rather than releasing
+// it twice. instances of this class reside in shared memory
+class LockJournal {
+public:
+    static constexpr uint32_t MAX_THREADS = 32;
+    static constexpr uint32_t MAX_ENTRIES = 15;
+
+    // the modes in which an entry holds its lock
+    static constexpr uint32_t READ = 1;
+    static constexpr uint32_t INTENT_READ = 2;
+    static constexpr uint32_t INTENT_WRITE = 4;
+
+    struct Entry {
+        // nullptr if the entry is unused
+        OffsetPtr<SpinMutex> lock;
+        // the slots which count the intention read, if any
+        OffsetPtr<ReaderSlots> slots;
+        uint32_t modes;
+    };
+
+    struct Block {
+        // the owner token of the process, or zero if the block is unused, see
+        // SpinMutex::owner_token
+        std::atomic_uint32_t owner;
+        // the pseudo thread id, which selects the reader slot
+        uint32_t tid;
+        Entry entries[MAX_ENTRIES];
+    };
+
+private:
+    Block blocks[MAX_THREADS];
+
+    // claims an unused block for the current thread, also taking over those of dead
+    // processes; returns nullptr if all are in use
+    Block* claim_block();
+
+    // the block of the current thread in the attached segment containing the lock, which is
+    // claimed on the first call; nullptr if there is none
+    static Block* find_block(const void* lock);
+
+    // releases the locks recorded in the block of a dead process; returns their number
+    static size_t release_block(Block& block, uint32_t owner);
+
+public:
+    LockJournal();
+
+    LockJournal(const LockJournal&) = delete;
+
+    LockJournal& operator=(const LockJournal&) = delete;
+
+    // records the locks in the address range of the segment containing this journal for the
+    // threads of this process, until detach is called
+    void attach(const void* begin, size_t size);
+
+    // stops recording and frees the blocks of the threads of this process
+    void detach();
+
+    // records that the current thread acquired the lock in the given mode; entry is the one
+    // returned for the lock before, or nullptr. returns the entry, or nullptr if the lock is
+    // not recorded
+    static Entry* record(Entry* entry, SpinMutex& lock, ReaderSlots* slots, uint32_t mode);
+
+    // drops the mode before the current thread releases the lock; returns the entry, or
+    // nullptr once it holds no mode anymore
+    static Entry* drop(Entry* entry, uint32_t mode);
+
+    // whether the lock is in a segment whose locks are recorded
+    static bool is_recorded(const SpinMutex& lock);
+
+    // releases the locks recorded by threads of dead processes in the segment containing the
+    // given lock; returns the number of released locks
+    static size_t recover(const SpinMutex& lock);
+};
+
+// collects the stats of the locks of fields below a field together with their paths, e.g.
+// "sub.list[2]", where the path of the field itself is empty
+class LockStatsCollector {
+    std::string path;
+    std::vector<std::pair<std::string, LockStats>> entries;
+
+public:
+    // adds the stats of the lock under the current path if it has any
+    void add(const SpinMutex& mutex);
+
+    // append a field name or list index to the current path; these return the previous length
+    // of the path, which leave restores
+    size_t enter(std::string_view name);
+    size_t enter(size_t index);
+
+    inline void leave(size_t length) { path.resize(length); }
+
+    // returns the count locks with the longest wait times, then the most contended ones
+    std::vector<std::pair<std::string, LockStats>> top(size_t count);
 };
 
 template<bool write>
@@ -82,6 +481,9 @@ class ScopedFieldLock {
 public:
     explicit ScopedFieldLock(const FieldTypeBase& field);
 
+    // tries to lock the field before the deadline; the lock is empty if this failed
+    ScopedFieldLock(const FieldTypeBase& field, LockDeadline& deadline);
+
     ScopedFieldLock(ScopedFieldLock&& other) noexcept : ScopedFieldLock() {
         *this = std::move(other);
     }
@@ -96,6 +498,8 @@ public:
 
     ~ScopedFieldLock() { unlock(); }
 
+    explicit operator bool() const { return field != nullptr; }
+
     void unlock();
 };
 
@@ -103,6 +507,10 @@ template<>
 ScopedFieldLock<false>::ScopedFieldLock(const FieldTypeBase& field);
 template<>
 ScopedFieldLock<true>::ScopedFieldLock(const FieldTypeBase& field);
+template<>
+ScopedFieldLock<false>::ScopedFieldLock(const FieldTypeBase& field, LockDeadline& deadline);
+template<>
+ScopedFieldLock<true>::ScopedFieldLock(const FieldTypeBase& field, LockDeadline& deadline);
 }
 
 #endif
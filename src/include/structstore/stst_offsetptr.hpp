@@ -9,10 +9,20 @@
 
 namespace structstore {
 
-template<typename diff_type = int32_t>
+// arenas larger than 2 GiB need 64-bit offsets and sizes, which is selected at compile
+// time with STST_ARENA_64BIT; otherwise, the more compact 32-bit layout is used
+#ifdef STST_ARENA_64BIT
+using arena_diff_type = int64_t;
+using arena_size_type = uint64_t;
+#else
+using arena_diff_type = int32_t;
+using arena_size_type = uint32_t;
+#endif
+
+template<typename diff_type = arena_diff_type>
 class OffsetPtrBase {};
 
-template<typename T, typename diff_type = int32_t>
+template<typename T, typename diff_type = arena_diff_type>
 class OffsetPtr : public OffsetPtrBase<diff_type> {
 public:
     static_assert(std::is_signed_v<diff_type>);
@@ -266,6 +266,23 @@ public:
         });
         cls.def("read_lock", [](W& w) { return unwrap(w).read_lock(); }, nb::rv_policy::move);
         cls.def("write_lock", [](W& w) { return unwrap(w).write_lock(); }, nb::rv_policy::move);
+        // these return None if the lock could not be acquired within the timeout
+        cls.def(
+                "try_read_lock",
+                [](W& w, double timeout) -> nb::object {
+                    auto lock = unwrap(w).try_read_lock(timeout);
+                    if (!lock) { return nb::none(); }
+                    return nb::cast(std::move(lock), nb::rv_policy::move);
+                },
+                nb::arg("timeout") = 0.0);
+        cls.def(
+                "try_write_lock",
+                [](W& w, double timeout) -> nb::object {
+                    auto lock = unwrap(w).try_write_lock(timeout);
+                    if (!lock) { return nb::none(); }
+                    return nb::cast(std::move(lock), nb::rv_policy::move);
+                },
+                nb::arg("timeout") = 0.0);
     }
 
     template<typename W>
@@ -380,6 +397,13 @@ public:
 
         cls.def("clear", [](W& w) { unwrap(w).clear(); });
 
+        cls.def(
+                "make_sub_arena",
+                [](W& w, size_t size, AllocMode mode) { unwrap(w).make_sub_arena(size, mode); },
+                nb::arg("size"), nb::arg("mode") = MINI_MALLOC);
+
+        cls.def("make_read_scalable", [](W& w) { unwrap(w).make_read_scalable(); });
+
         cls.def("check", [](W& w) {
             STST_LOG_DEBUG() << "checking from python ...";
             w.check();
@@ -28,6 +28,17 @@ enum CleanupMode {
     ALWAYS
 };
 
+// options for mapping a shared segment, which can be combined with |
+enum MapOptions {
+    // backs the segment with huge pages; segments on hugetlbfs and memfd segments created with
+    // this option use them directly, other segments are advised to use transparent huge pages
+    HUGE_PAGES = 1,
+    // maps all pages of the segment right away, avoiding page faults on first access
+    PREFAULT = 2,
+    // locks the pages of the segment in RAM, which also prefaults them
+    LOCK_MEMORY = 4
+};
+
 class FD {
     FD(const FD&) = delete;
 
@@ -79,13 +90,18 @@ class StructStoreShared {
     // instances of this class reside in shared memory, thus no raw pointers
     // or references should be used; use structstore::OffsetPtr<T> instead.
     struct SharedData {
+        // current size of the segment, which grows up to max_size
         size_t size;
+        // size of the mapped address range
+        size_t max_size;
         std::atomic_int32_t usage_count;
         SharedAlloc sh_alloc;
         OffsetPtr<StructStore> store;
         std::atomic_bool invalidated;
+        LockJournal journal;
 
-        SharedData(size_t size, size_t bufsize, void* buffer);
+        SharedData(size_t size, size_t max_size, size_t bufsize, void* buffer,
+                   AllocMode alloc_mode);
 
         SharedData() = delete;
 
@@ -105,12 +121,26 @@ class StructStoreShared {
     SharedData* sh_data_ptr{};
     bool use_file{};
     CleanupMode cleanup{};
+    int map_options{};
+    // the offset from the start of the segment at which the next compaction step continues
+    size_t compaction_block{};
+    double lock_timeout{LockDeadline::DEFAULT_TIMEOUT};
 
 public:
+    // if max_bufsize is larger than bufsize, the segment grows on demand up to max_bufsize;
+    // map_options is a combination of MapOptions, which applies to this process only;
+    // alloc_mode is only used when the segment is created
     explicit StructStoreShared(const std::string& path, size_t bufsize = 4096, bool reinit = false,
-                               bool use_file = false, CleanupMode cleanup = IF_LAST);
+                               bool use_file = false, CleanupMode cleanup = IF_LAST,
+                               size_t max_bufsize = 0, int map_options = 0,
+                               AllocMode alloc_mode = MINI_MALLOC);
 
-    explicit StructStoreShared(int fd, bool init);
+    explicit StructStoreShared(int fd, bool init, int map_options = 0);
+
+    // creates an anonymous memory file for a segment with bufsize bytes of arena, which is
+    // backed by huge pages if map_options contains HUGE_PAGES; the returned fd can be passed
+    // to StructStoreShared(fd, true) and to other processes, e.g. via a unix domain socket
+    static int create_memfd(const std::string& name, size_t bufsize, int map_options = 0);
 
     StructStoreShared(StructStoreShared&& other) noexcept {
         *this = std::move(other);
@@ -122,6 +152,9 @@ public:
         sh_data_ptr = other.sh_data_ptr;
         use_file = other.use_file;
         cleanup = other.cleanup;
+        map_options = other.map_options;
+        compaction_block = other.compaction_block;
+        lock_timeout = other.lock_timeout;
         other.sh_data_ptr = nullptr;
         other.cleanup = NEVER;
         return *this;
@@ -129,8 +162,16 @@ public:
 
 private:
 
+    // applies map_options to the freshly mapped segment, of which size bytes are in use
+    void apply_map_options(int fd_num, size_t size, size_t max_size);
+
     void mmap_existing_fd();
 
+    void enable_growth();
+
+    // makes lock_timeout apply to the store in this process, or stops that
+    void register_lock_timeout(bool active);
+
 public:
 
     bool valid() const {
@@ -160,6 +201,17 @@ public:
         return (*sh_data_ptr->store)[name];
     }
 
+    FieldAccess<true> operator[](const FieldKey& key) {
+        assert_valid();
+        return (*sh_data_ptr->store)[key];
+    }
+
+    template<typename T>
+    FieldHandle<T> handle(const std::string& name) {
+        assert_valid();
+        return sh_data_ptr->store->handle<T>(name);
+    }
+
     ~StructStoreShared() {
         STST_LOG_DEBUG() << "deconstructing shared StructStore at " << sh_data_ptr;
         close();
@@ -177,6 +229,46 @@ public:
         return sh_data_ptr->size;
     }
 
+    mm_stats stats() const {
+        assert_valid();
+        return sh_data_ptr->sh_alloc.stats();
+    }
+
+    // drops all fields at once by resetting the arena, which is the only way to reclaim memory
+    // in BUMP_POINTER mode; the store must not be accessed concurrently
+    void reset();
+
+    // drops the interned field names which are not used anymore, so that stores with changing
+    // field names do not fill up the name table; returns the number of dropped names. the whole
+    // store is write-locked meanwhile. the tables of the sub-arenas below are swept, too. this
+    // is also done at the start of each compaction pass
+    size_t reclaim_names();
+
+    // moves the memory owned by the fields, e.g. string and matrix data, towards the start of
+    // the arena, which merges fragmented free memory; the fields themselves stay in place.
+    // the whole store is write-locked meanwhile. matrix data may be moved, thus numpy arrays
+    // referencing it have to be fetched again
+    void compact();
+
+    // does a part of compact() taking at most about max_pause seconds, such that the store
+    // is not locked for too long; each call continues where the last one stopped. returns
+    // true when a full pass over the store has been completed
+    bool compact_step(double max_pause);
+
+    // sets how long locking fields of this store waits in this process before failing, in
+    // seconds; a negative timeout waits forever, zero fails at once if a lock is taken.
+    // the default is LockDeadline::DEFAULT_TIMEOUT
+    void set_lock_timeout(double timeout);
+
+    inline double get_lock_timeout() const { return lock_timeout; }
+
+    // returns the paths and stats of the count locks of this store which were waited for the
+    // longest in this process, see SpinMutex::set_instrumentation. the root store has an empty
+    // path, the locks of the arena and its name table are named <alloc> and <strings>. if a
+    // writer below the root holds its lock meanwhile, the fields below the root are left out.
+    // collecting the stats takes locks, which are not recorded themselves
+    std::vector<std::pair<std::string, LockStats>> contended_locks(size_t count) const;
+
     void to_buffer(void* buffer, size_t bufsize) const;
 
     void from_buffer(void* buffer, size_t bufsize);
@@ -55,6 +55,15 @@ public:
         field_map.check(sh_alloc, *this);
     }
 
+    inline void compact(Compaction& compaction) { field_map.compact(compaction); }
+
+    inline void collect_lock_stats(LockStatsCollector& collector) const {
+        collector.add(this->mutex);
+        field_map.collect_lock_stats(collector);
+    }
+
+    inline size_t reclaim_names() { return field_map.reclaim_names(); }
+
     inline bool operator==(const Struct& other) const { return field_map == other.field_map; }
 };
 
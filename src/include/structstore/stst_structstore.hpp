@@ -7,26 +7,43 @@
 #include "structstore/stst_typing.hpp"
 #include "structstore/stst_utils.hpp"
 
+#include <cstring>
+#include <type_traits>
+
 namespace structstore {
 
 class py;
 
+template<typename T>
+class FieldHandle;
+
 // todo: when returning a FieldAccess, there should be a read lock on the parent StructStore
 
 // instances of this class reside in shared memory, thus no raw pointers
 // or references should be used; use structstore::OffsetPtr<T> instead.
 class StructStore : public FieldType<StructStore> {
     friend class ::structstore::typing;
+    friend class ::structstore::FieldTypeBase;
     friend class ::structstore::SharedAlloc;
     friend class ::structstore::StlAllocator<StructStore>;
     friend class ::structstore::StructStoreShared;
     friend class ::structstore::py;
+    template<typename T>
+    friend class ::structstore::FieldHandle;
 
 public:
     static const TypeInfo& type_info;
 
 protected:
     FieldMap<true> field_map;
+    // set if this store owns a sub-arena, which is a block of this arena
+    OffsetPtr<SharedAlloc> parent_alloc;
+    // set if the lock of this store counts its readers in these slots, see make_read_scalable
+    OffsetPtr<ReaderSlots> reader_slots;
+
+    void release_sub_arena();
+
+    void release_reader_slots();
 
     StructStore(const StructStore& other) : StructStore{static_alloc} { *this = other; }
 
@@ -45,9 +62,30 @@ public:
 
     ~StructStore() {
         STST_LOG_DEBUG() << "deconstructing StructStore at " << this;
-        clear();
+        if (parent_alloc) {
+            release_sub_arena();
+        } else {
+            clear();
+        }
+        if (reader_slots) { release_reader_slots(); }
     }
 
+    // gives this store its own arena of bufsize bytes, carved out of the current arena, with its
+    // own allocator lock; all fields below are allocated from it, and clearing or destroying
+    // this store releases it at once. the store has to be empty
+    void make_sub_arena(size_t bufsize, AllocMode mode = MINI_MALLOC);
+
+    inline bool has_sub_arena() const { return (bool) parent_alloc; }
+
+    // lets readers of fields below this store count themselves in several cache lines instead
+    // of the lock word, such that many concurrent readers scale; writers of this store then
+    // have to wait for all slots to drain. read locks below this store have to be released by
+    // the thread which acquired them. this must not be called while other threads or processes
+    // use this store
+    void make_read_scalable();
+
+    inline bool is_read_scalable() const { return (bool) reader_slots; }
+
     // FieldTypeBase utility functions
 
     inline void to_text(std::ostream& os) const { field_map.to_text(os); }
@@ -56,6 +94,20 @@ public:
 
     void check(const SharedAlloc* sh_alloc = nullptr) const;
 
+    inline void compact(Compaction& compaction) { field_map.compact(compaction); }
+
+    inline void collect_lock_stats(LockStatsCollector& collector) const {
+        collector.add(mutex);
+        field_map.collect_lock_stats(collector);
+    }
+
+    // the names of a sub-arena are interned in its own StringStorage
+    inline size_t reclaim_names() {
+        size_t reclaimed = field_map.reclaim_names();
+        if (parent_alloc) { reclaimed += get_alloc().strings().reclaim(); }
+        return reclaimed;
+    }
+
     inline bool operator==(const StructStore& other) const { return field_map == other.field_map; }
 
     // query operations
@@ -66,24 +118,93 @@ public:
 
     FieldAccess<true> at(const std::string& name);
 
+    FieldAccess<true> at(const FieldKey& key);
+
     // insert operations
 
     FieldAccess<true> operator[](const std::string& name);
 
+    FieldAccess<true> operator[](const FieldKey& key);
+
     template<typename T>
     T& get(const std::string& name) {
         return (*this)[name];
     }
 
+    template<typename T>
+    T& get(const FieldKey& key) {
+        return (*this)[key];
+    }
+
     StructStore& substore(const std::string& name) { return get<StructStore>(name); }
 
+    // returns a handle to the field with the given name, created if needed, which caches the
+    // location of the data; see FieldHandle
+    template<typename T>
+    FieldHandle<T> handle(const std::string& name) {
+        return FieldHandle<T>{*this, name};
+    }
+
     // remove operations
 
-    inline void clear() { field_map.clear(); }
+    void clear();
 
     inline void remove(const std::string& name) { field_map.remove(name); }
 };
 
+// this class resides in local stack or heap memory;
+// it refers to the data of a field of a StructStore, which is looked up once and then cached
+// until data of fields of the store is destroyed, e.g. by removing or clearing a field; then it
+// is looked up again on the next access, creating the field if needed.
+// the handle has to be accessed under the same locks as the store
+template<typename T>
+class FieldHandle {
+    static_assert(typing::is_field_type<T>, "field handle with invalid type");
+
+    StructStore* store;
+    std::string name;
+    T* data = nullptr;
+    uint64_t generation = 0;
+
+    T& resolve() {
+        generation = store->field_map.get_generation();
+        data = &store->get<T>(name);
+        return *data;
+    }
+
+public:
+    FieldHandle(StructStore& store, std::string name) : store{&store}, name{std::move(name)} {
+        resolve();
+    }
+
+    inline T& get() {
+        if (generation != store->field_map.get_generation()) { return resolve(); }
+        return *data;
+    }
+
+    // returns a copy of the data without writing to shared memory, see
+    // FieldTypeBase::read_consistent; only for trivially copyable types
+    T read() {
+        static_assert(std::is_trivially_copyable_v<T>);
+        T value;
+        bool valid = false;
+        store->read_consistent([&]() {
+            valid = generation == store->field_map.get_generation();
+            if (valid) { std::memcpy((void*) &value, (const void*) data, sizeof(T)); }
+        });
+        if (valid) { return value; }
+        // the field has to be looked up again, which might create it
+        auto lock = store->write_lock();
+        return get();
+    }
+
+    inline T& operator*() { return get(); }
+
+    inline T* operator->() { return &get(); }
+
+    inline const std::string& get_name() const { return name; }
+};
+
 static_assert(std::is_same_v<unwrap_type_t<FieldRef<StructStore>>, StructStore>);
 static_assert(std::is_same_v<wrap_type_w<StructStore>, FieldRef<StructStore>>);
 } // namespace structstore
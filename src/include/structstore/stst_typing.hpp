@@ -28,6 +28,7 @@ class FieldTypeBase {
 protected:
     template<bool write>
     friend class ScopedFieldLock;
+    friend class LockDeadline;
     friend class py;
 
     mutable SpinMutex mutex = {};
@@ -39,17 +40,88 @@ protected:
     FieldTypeBase& operator=(const FieldTypeBase&) { return *this; }
     FieldTypeBase& operator=(FieldTypeBase&&) { return *this; }
 
+    // the reader slots of the lock if it is scalable, which only locks of stores can be, see
+    // StructStore::make_read_scalable
+    inline ReaderSlots* get_reader_slots() const {
+        return mutex.is_scalable() ? get_store_reader_slots() : nullptr;
+    }
+
+    ReaderSlots* get_store_reader_slots() const;
+
+    // locking a field locks its parents with the intention to read or write below them, such
+    // that readers of a parent exclude writers of its fields, but writers of different fields
+    // do not exclude each other. each thread counts the locks it holds, thus locking a field
+    // again or below a field which this thread has locked already does not write to the locks
+    // of the parents, and a read or write lock of a parent covers the same lock of its fields
+
+    // these return false if the field or one of its parents could not be locked before the
+    // deadline, in which case nothing is locked
+    bool try_read_lock_(LockDeadline& deadline) const { return try_lock_(false, deadline); }
+    bool try_write_lock_(LockDeadline& deadline) const { return try_lock_(true, deadline); }
+
+    // these throw if the lock could not be acquired within the timeout of the store
     void read_lock_() const;
-    void read_unlock_() const;
+    void read_unlock_() const { unlock_(false); }
     void write_lock_() const;
-    void write_unlock_() const;
-    void read_or_write_lock_() const;
-    void read_or_write_unlock_() const;
+    void write_unlock_() const { unlock_(true); }
+
+    bool try_lock_(bool write, LockDeadline& deadline) const;
+    void unlock_(bool write) const;
+
+    // returns the closest parent which the current thread has locked in the same mode, or
+    // nullptr
+    const FieldTypeBase* find_cover_(bool write) const;
+
+    // locks the parents with the intention to read or write below them
+    bool try_lock_parents_(bool write, LockDeadline& deadline) const;
+
+    // unlocks the parents below stop, which are all parents by default
+    void unlock_parents_(bool write, const FieldTypeBase* stop = nullptr) const;
+
+    // the deepest field which can be read optimistically, see read_consistent
+    static constexpr size_t MAX_OPTIMISTIC_DEPTH = 16;
+    static constexpr int MAX_OPTIMISTIC_TRIES = 8;
+
+    // stores the versions of the locks of this field and its parents and returns their count,
+    // or 0 if one of them is write-locked by another thread or there are too many of them
+    size_t read_versions(uint32_t* versions) const;
+
+    bool check_versions(const uint32_t* versions, size_t count) const;
 
 public:
     [[nodiscard]] ScopedFieldLock<false> read_lock() const { return ScopedFieldLock<false>(*this); }
 
     [[nodiscard]] ScopedFieldLock<true> write_lock() const { return ScopedFieldLock<true>(*this); }
+
+    // these return an empty lock if the lock could not be acquired within the timeout in
+    // seconds; a negative timeout waits forever
+    [[nodiscard]] ScopedFieldLock<false> try_read_lock(double timeout) const {
+        LockDeadline deadline{timeout};
+        return ScopedFieldLock<false>(*this, deadline);
+    }
+
+    [[nodiscard]] ScopedFieldLock<true> try_write_lock(double timeout) const {
+        LockDeadline deadline{timeout};
+        return ScopedFieldLock<true>(*this, deadline);
+    }
+
+    // calls fn, which copies trivially copyable data protected by the lock of this field, such
+    // that the copy is consistent, without writing to shared memory: fn is called again if the
+    // field or one of its parents was write-locked meanwhile, and after a few tries, it is
+    // called under a read lock. fn might see inconsistent data in the failed tries, thus it
+    // must not follow pointers read from the data
+    template<typename Fn>
+    void read_consistent(Fn&& fn) const {
+        uint32_t versions[MAX_OPTIMISTIC_DEPTH];
+        for (int i = 0; i < MAX_OPTIMISTIC_TRIES; ++i) {
+            size_t count = read_versions(versions);
+            if (count == 0) { continue; }
+            fn();
+            if (check_versions(versions, count)) { return; }
+        }
+        auto lock = read_lock();
+        fn();
+    }
 };
 
 template<typename T>
@@ -77,7 +149,36 @@ public:
                     std::is_same_v<decltype(std::declval<T>() = std::declval<const T>()), T&>);
         }
 
+        // checks the field if its lock was recovered from a dead process, see
+        // SpinMutex::is_suspect; the check throws if the field was left inconsistent
+        template<bool write>
+        ScopedFieldLock<write> checked(ScopedFieldLock<write> lock) const {
+            if (lock && this->mutex.is_suspect()) {
+                ((const T*) this)->check(nullptr);
+                this->mutex.clear_suspect();
+            }
+            return lock;
+        }
+
     public:
+        // these shadow the locks of FieldTypeBase to check the field after a recovery
+
+        [[nodiscard]] ScopedFieldLock<false> read_lock() const {
+            return checked(FieldTypeBase::read_lock());
+        }
+
+        [[nodiscard]] ScopedFieldLock<true> write_lock() const {
+            return checked(FieldTypeBase::write_lock());
+        }
+
+        [[nodiscard]] ScopedFieldLock<false> try_read_lock(double timeout) const {
+            return checked(FieldTypeBase::try_read_lock(timeout));
+        }
+
+        [[nodiscard]] ScopedFieldLock<true> try_write_lock(double timeout) const {
+            return checked(FieldTypeBase::try_write_lock(timeout));
+        }
+
         using Ref = FieldRef<T>;
 
         static FieldRef<T> create() { return FieldRef<T>::create(); }
@@ -88,6 +189,19 @@ public:
         }
 
         inline bool operator!=(const T& other) const { return !((const T&) *this == other); }
+
+        // moves the blocks owned by this field towards the start of its arena, see Compaction;
+        // the field itself stays in place. types which own blocks override this
+        void compact(Compaction&) {}
+
+        // adds the stats of the locks of this field and the fields below it, see
+        // StructStoreShared::contended_locks. types which contain fields override this
+        void collect_lock_stats(LockStatsCollector& collector) const { collector.add(this->mutex); }
+
+        // drops the unused names of the sub-arenas below this field, see
+        // StructStoreShared::reclaim_names; returns their number. types which contain fields
+        // override this
+        size_t reclaim_names() { return 0; }
     };
 
     template<typename T>
@@ -109,6 +223,12 @@ public:
 
     using CopyFn = std::function<void(SharedAlloc&, void*, const void*)>;
 
+    using CompactFn = std::function<void(void*, Compaction&)>;
+
+    using CollectLockStatsFn = std::function<void(const void*, LockStatsCollector&)>;
+
+    using ReclaimNamesFn = std::function<size_t(void*)>;
+
     struct TypeInfo {
         type_hash_t type_hash;
         std::string name;
@@ -120,6 +240,9 @@ public:
         CheckFn check_fn;
         CmpEqualFn cmp_equal_fn;
         CopyFn copy_fn;
+        CompactFn compact_fn;
+        CollectLockStatsFn collect_lock_stats_fn;
+        ReclaimNamesFn reclaim_names_fn;
     };
 
 private:
@@ -175,6 +298,17 @@ private:
             return *(const T*) t == *(const T*) other;
         };
         ti.copy_fn = [](SharedAlloc&, void* t, const void* other) { *(T*) t = *(const T*) other; };
+        if constexpr (std::is_class_v<T>) {
+            ti.compact_fn = [](void* t, Compaction& compaction) { ((T*) t)->compact(compaction); };
+            ti.collect_lock_stats_fn = [](const void* t, LockStatsCollector& collector) {
+                ((const T*) t)->collect_lock_stats(collector);
+            };
+            ti.reclaim_names_fn = [](void* t) { return ((T*) t)->reclaim_names(); };
+        } else {
+            ti.compact_fn = [](void*, Compaction&) {};
+            ti.collect_lock_stats_fn = [](const void*, LockStatsCollector&) {};
+            ti.reclaim_names_fn = [](void*) { return (size_t) 0; };
+        }
         return ti;
     }
 
@@ -201,6 +335,9 @@ private:
             return *(const T*) t == *(const T*) other || **(const T*) t == **(const T*) other;
         };
         ti.copy_fn = [](SharedAlloc&, void* t, const void* other) { *(T*) t = *(const T*) other; };
+        ti.compact_fn = [](void*, Compaction&) {};
+        ti.collect_lock_stats_fn = [](const void*, LockStatsCollector&) {};
+        ti.reclaim_names_fn = [](void*) { return (size_t) 0; };
         return ti;
     }
 
@@ -219,6 +356,9 @@ private:
         };
         t.cmp_equal_fn = [](const void*, const void*) { return true; };
         t.copy_fn = [](SharedAlloc&, void*, const void*) {};
+        t.compact_fn = [](void*, Compaction&) {};
+        t.collect_lock_stats_fn = [](const void*, LockStatsCollector&) {};
+        t.reclaim_names_fn = [](void*) { return (size_t) 0; };
         return t;
     }
 
@@ -1,29 +1,49 @@
 #include "structstore/mini_malloc.hpp"
+#include "structstore/stst_callstack.hpp"
+#include "structstore/stst_offsetptr.hpp"
 #include "structstore/stst_utils.hpp"
 
 #include <cassert>
 #include <cmath>
 #include <cstdint>
+#include <cstring>
+#include <limits>
 
 #define ALIGN 8
 #define SIZES_COUNT 59
-#define MAX_PTRDIFF_VAL ((INT64_C(1) << 31) - 1)
+#define MAX_PTRDIFF_VAL (std::numeric_limits<ptrdiff_type>::max())
 
-// for an allocated node, only the first 8 bytes of the struct are needed.
+// for an allocated node, only the size fields at the start of the struct are needed.
+#ifdef STST_ARENA_64BIT
+#define ALLOC_NODE_SIZE 16
+#else
 #define ALLOC_NODE_SIZE 8
-#define ALLOCATED_FLAG UINT32_C(1)
+#endif
+// a free node additionally needs space for the two free list links
+#define MIN_NODE_SIZE ALLOC_NODE_SIZE
+#define ALLOCATED_FLAG ((size_type) 1)
 
 namespace structstore {
 
 typedef uint8_t byte;
-typedef uint32_t size_type;
+typedef arena_size_type size_type;
 typedef int16_t size_index_type;
-typedef int32_t ptrdiff_type;
+typedef arena_diff_type ptrdiff_type;
 
 static size_type sizes[SIZES_COUNT];
 
 typedef struct mini_malloc {
+    // bit i is set iff free_nodes[i] is non-empty
+    uint64_t nonempty_bins;
+    // statistics, see mm_get_stats
+    uint64_t blocksize;
+    uint64_t used_bytes;
+    uint64_t allocation_count;
+    uint64_t high_water_bytes;
+    uint64_t failed_allocations;
     ptrdiff_type _head;
+    // free nodes of the largest size index are not kept in a list, but in a treap
+    // ordered by size; free_nodes[SIZES_COUNT - 1] then points to its root
     ptrdiff_type free_nodes[SIZES_COUNT];
 } mini_malloc;
 
@@ -32,6 +52,7 @@ typedef struct memnode {
     size_type size;
     // 0 if this is the first node in block; MSB set if node is allocated (ALLOCATED_FLAG)
     size_type prev_node_size;
+    // for nodes in the treap, these are the offsets to the left and right child
     ptrdiff_type d_next_free_node;
     ptrdiff_type d_prev_free_node;
 } memnode;
@@ -153,17 +174,143 @@ static memnode* get_prev_node(memnode* node) {
     return (memnode*) (((byte*) node) - (prev_node_size + ALLOC_NODE_SIZE));
 }
 
+// returns the next node, which might be the end marker of the block
+static memnode* get_following_node(memnode* node) {
+    return (memnode*) (((byte*) node) + (node->size + ALLOC_NODE_SIZE));
+}
+
 static memnode* get_next_node(memnode* node) {
-    memnode* next_node = (memnode*) (((byte*) node) + (node->size + ALLOC_NODE_SIZE));
+    memnode* next_node = get_following_node(node);
     // last node in a block has size 0
     if (next_node->size == 0) { return NULL; }
     return next_node;
 }
 
+// treap of big free nodes, ordered by (size, address); the priorities are derived
+// from the node offsets in the block, so they are the same in all processes
+
+static inline memnode* get_left_node(memnode* node) { return get_next_free_node(node); }
+
+static inline memnode* get_right_node(memnode* node) { return get_prev_free_node(node); }
+
+static inline void set_left_node(memnode* node, memnode* left) { set_next_free_node(node, left); }
+
+static inline void set_right_node(memnode* node, memnode* right) {
+    set_prev_free_node(node, right);
+}
+
+static inline uint32_t get_node_priority(mini_malloc* mm, memnode* node) {
+    uint64_t offset = ((byte*) node - (byte*) mm) / ALIGN;
+    return (uint32_t) ((offset * UINT64_C(0x9E3779B97F4A7C15)) >> 32);
+}
+
+static inline bool is_less_node(memnode* node1, memnode* node2) {
+    return node1->size < node2->size || (node1->size == node2->size && node1 < node2);
+}
+
+// splits the treap into nodes less than key and nodes greater than key
+static void split_nodes(memnode* root, memnode* key, memnode** left, memnode** right) {
+    if (root == NULL) {
+        *left = NULL;
+        *right = NULL;
+    } else if (is_less_node(root, key)) {
+        memnode* root_right;
+        split_nodes(get_right_node(root), key, &root_right, right);
+        set_right_node(root, root_right);
+        *left = root;
+    } else {
+        memnode* root_left;
+        split_nodes(get_left_node(root), key, left, &root_left);
+        set_left_node(root, root_left);
+        *right = root;
+    }
+}
+
+// merges two treaps where all nodes in left are less than all nodes in right
+static memnode* merge_nodes(mini_malloc* mm, memnode* left, memnode* right) {
+    if (left == NULL) { return right; }
+    if (right == NULL) { return left; }
+    if (get_node_priority(mm, left) > get_node_priority(mm, right)) {
+        set_right_node(left, merge_nodes(mm, get_right_node(left), right));
+        return left;
+    }
+    set_left_node(right, merge_nodes(mm, left, get_left_node(right)));
+    return right;
+}
+
+static memnode* insert_tree_node(mini_malloc* mm, memnode* root, memnode* node) {
+    if (root == NULL || get_node_priority(mm, node) > get_node_priority(mm, root)) {
+        memnode *left, *right;
+        split_nodes(root, node, &left, &right);
+        set_left_node(node, left);
+        set_right_node(node, right);
+        return node;
+    }
+    if (is_less_node(node, root)) {
+        set_left_node(root, insert_tree_node(mm, get_left_node(root), node));
+    } else {
+        set_right_node(root, insert_tree_node(mm, get_right_node(root), node));
+    }
+    return root;
+}
+
+static memnode* remove_tree_node(mini_malloc* mm, memnode* root, memnode* node) {
+    assert(root != NULL);
+    if (root == node) { return merge_nodes(mm, get_left_node(node), get_right_node(node)); }
+    if (is_less_node(node, root)) {
+        set_left_node(root, remove_tree_node(mm, get_left_node(root), node));
+    } else {
+        set_right_node(root, remove_tree_node(mm, get_right_node(root), node));
+    }
+    return root;
+}
+
+// returns the smallest big free node with at least the given size
+static memnode* find_tree_node(mini_malloc* mm, size_type size) {
+    memnode* node = get_free_nodes_first(mm, SIZES_COUNT - 1);
+    memnode* best_node = NULL;
+    while (node != NULL) {
+        if (node->size < size) {
+            node = get_right_node(node);
+        } else {
+            best_node = node;
+            node = get_left_node(node);
+        }
+    }
+    return best_node;
+}
+
 static void prepend_free_node(mini_malloc* mm, memnode* node, size_index_type size_index) {
-    memnode* old_first_free = get_free_nodes_first(mm, size_index);
-    attach_free_nodes(get_free_nodes_head(mm, size_index), node);
-    attach_free_nodes(node, old_first_free);
+    if (size_index == SIZES_COUNT - 1) {
+        memnode* head = get_free_nodes_head(mm, size_index);
+        set_next_free_node(head, insert_tree_node(mm, get_next_free_node(head), node));
+    } else {
+        memnode* old_first_free = get_free_nodes_first(mm, size_index);
+        attach_free_nodes(get_free_nodes_head(mm, size_index), node);
+        attach_free_nodes(node, old_first_free);
+    }
+    mm->nonempty_bins |= UINT64_C(1) << size_index;
+}
+
+static void remove_free_node(mini_malloc* mm, memnode* node) {
+    // free nodes are always stored in the list of their lower size index
+    size_index_type size_index = get_size_index_lower(node->size);
+    if (size_index == SIZES_COUNT - 1) {
+        memnode* head = get_free_nodes_head(mm, size_index);
+        set_next_free_node(head, remove_tree_node(mm, get_next_free_node(head), node));
+    } else {
+        attach_free_nodes(get_prev_free_node(node), get_next_free_node(node));
+    }
+    if (get_free_nodes_first(mm, size_index) == NULL) {
+        mm->nonempty_bins &= ~(UINT64_C(1) << size_index);
+    }
+}
+
+// returns the first non-empty size index at or above size_index, or SIZES_COUNT
+static size_index_type find_nonempty_bin(mini_malloc* mm, size_index_type size_index) {
+    uint64_t bins = mm->nonempty_bins & (~UINT64_C(0) << size_index);
+    if (bins == 0) { return SIZES_COUNT; }
+    return (size_index_type) __builtin_ctzll(bins);
 }
 
 void structstore::init_mini_malloc(mini_malloc* mm, size_t blocksize) {
@@ -173,7 +320,9 @@ void structstore::init_mini_malloc(mini_malloc* mm, size_t blocksize) {
 
     // ensure alignment
     static_assert((ALLOC_NODE_SIZE % ALIGN) == 0);
-    static_assert(sizeof(memnode) == 16);
+    static_assert(sizeof(memnode) == ALLOC_NODE_SIZE + MIN_NODE_SIZE);
+    static_assert(SIZES_COUNT <= 64);
+    static_assert(SIZES_COUNT == MM_SIZE_CLASSES);
 
     // init size array
     for (uint32_t bits = 1; bits <= 64; ++bits) {
@@ -188,42 +337,78 @@ void structstore::init_mini_malloc(mini_malloc* mm, size_t blocksize) {
     for (size_index_type size_index = -1; size_index < SIZES_COUNT; size_index++) {
         mm->free_nodes[size_index] = 0;
     }
+    mm->nonempty_bins = 0;
+    mm->blocksize = blocksize + sizeof(mini_malloc);
+    mm->used_bytes = 0;
+    mm->allocation_count = 0;
+    mm->high_water_bytes = 0;
+    mm->failed_allocations = 0;
     // allocate first block
     memnode* block_node = (memnode*) buffer;
     assert(block_node != NULL);
     block_node->d_next_free_node = 0;
     block_node->prev_node_size = 0; // also sets to unallocated
-    set_prev_free_node(block_node, get_free_nodes_head(mm, SIZES_COUNT - 1));
     block_node->size = block_node_size;
     memnode* last_node = (memnode*) (((byte*) block_node) + (block_node->size + ALLOC_NODE_SIZE));
+    last_node->prev_node_size = block_node_size;
     set_allocated(last_node);
     last_node->size = 0;
-    set_next_free_node(get_free_nodes_head(mm, SIZES_COUNT - 1), block_node);
+    prepend_free_node(mm, block_node, get_size_index_lower(block_node_size));
     assert((byte*) last_node + ALLOC_NODE_SIZE == (byte*) buffer + blocksize);
 }
 
-void* structstore::mm_allocate(mini_malloc* mm, size_t size) {
-    if (size == 0) return NULL;
+// shrinks a node which is not in a free nodes list to size bytes and makes the rest a
+// new free node, if it is big enough; the node following it must not be free
+static void split_node(mini_malloc* mm, memnode* node, size_t size) {
+    int64_t left_size = (int64_t) node->size - (int64_t) size - ALLOC_NODE_SIZE;
+    assert(left_size >= -ALLOC_NODE_SIZE);
+    if (left_size >= MIN_NODE_SIZE) {
+        assert(left_size % ALIGN == 0);
+        size_index_type left_size_index = get_size_index_lower(left_size);
+        memnode* new_node = (memnode*) (((byte*) node) + size + ALLOC_NODE_SIZE);
+        new_node->size = left_size;
+        node->size = size;
+        new_node->d_prev_free_node = 0;
+        new_node->d_next_free_node = 0;
+        new_node->prev_node_size = node->size; // also sets to unallocated
+        // this also updates the end marker, which is needed when growing the block
+        set_prev_node_size(get_following_node(new_node), new_node->size);
+        // prepend new_node to free nodes list:
+        prepend_free_node(mm, new_node, left_size_index);
+        assert(left_size_index == SIZES_COUNT - 1 ||
+               get_free_nodes_first(mm, left_size_index) == new_node);
+    }
+}
+
+// merges the free node following the given node, which is not in a free nodes list, into it
+static void absorb_next_node(mini_malloc* mm, memnode* node) {
+    memnode* next_node = get_next_node(node);
+    assert(next_node != NULL && !is_allocated(next_node));
+    remove_free_node(mm, next_node);
+    node->size += next_node->size + ALLOC_NODE_SIZE;
+    set_prev_node_size(get_following_node(node), node->size);
+}
+
+static memnode* allocate_node(mini_malloc* mm, size_t size) {
+    if (size > std::numeric_limits<size_type>::max() - ALIGN) { return NULL; }
 
     if (size % ALIGN) {
         size += ALIGN - size % ALIGN;
         assert(size % ALIGN == 0);
     }
+    if (size < MIN_NODE_SIZE) { size = MIN_NODE_SIZE; }
     size_index_type size_index = get_size_index_upper(size);
     assert(size_index >= 0 && size_index < SIZES_COUNT);
     if (size_index < SIZES_COUNT - 1) { size = sizes[size_index]; }
-    memnode* node = NULL;
     // search for first free node
-    do {
-        assert(size_index >= 0 && size_index < SIZES_COUNT);
-        node = get_free_nodes_first(mm, size_index);
-    } while (node == NULL && ++size_index < SIZES_COUNT);
-
-    if (node == NULL) { return NULL; }
+    size_index = find_nonempty_bin(mm, size_index);
+    if (size_index == SIZES_COUNT) { return NULL; }
+    memnode* node = get_free_nodes_first(mm, size_index);
+    assert(node != NULL);
     assert(node->size > 0);
     if (size_index == SIZES_COUNT - 1) {
-        // linearly search all big nodes for a big enough one
-        while (node != NULL && node->size < size) { node = get_next_free_node(node); }
+        // best fit search of all big nodes
+        node = find_tree_node(mm, size);
         if (node == NULL) { return NULL; }
     }
     if (node->size < size) {
@@ -231,53 +416,160 @@ void* structstore::mm_allocate(mini_malloc* mm, size_t size) {
         return NULL;
     }
 
-    // split node if big enough
-    int32_t left_size = node->size - size - ALLOC_NODE_SIZE;
-    assert(left_size >= -ALLOC_NODE_SIZE);
-    if (left_size >= ALIGN) {
-        assert(left_size % ALIGN == 0);
-        size_index_type left_size_index = get_size_index_lower(left_size);
-        memnode* new_node = (memnode*) (((byte*) node) + size + ALLOC_NODE_SIZE);
-        new_node->size = left_size;
-        node->size = size;
-        new_node->d_prev_free_node = 0;
-        new_node->d_next_free_node = 0;
-        new_node->prev_node_size = node->size; // also sets to unallocated
-        memnode* next_node = get_next_node(new_node);
-        if (next_node != NULL) { set_prev_node_size(next_node, new_node->size); }
-        // prepend new_node to free nodes list:
-        prepend_free_node(mm, new_node, left_size_index);
-        assert(get_free_nodes_first(mm, left_size_index) == new_node);
-    }
     // remove node from free nodes list:
-    attach_free_nodes(get_prev_free_node(node), get_next_free_node(node));
+    remove_free_node(mm, node);
+    split_node(mm, node, size);
     set_allocated(node);
+    return node;
+}
+
+static void* count_allocated_node(mini_malloc* mm, memnode* node) {
+    if (node == NULL) {
+        ++mm->failed_allocations;
+        return NULL;
+    }
+    mm->used_bytes += node->size;
+    ++mm->allocation_count;
+    if (mm->used_bytes > mm->high_water_bytes) { mm->high_water_bytes = mm->used_bytes; }
     return ((byte*) node) + ALLOC_NODE_SIZE;
 }
 
+void* structstore::mm_allocate(mini_malloc* mm, size_t size) {
+    if (size == 0) return NULL;
+    return count_allocated_node(mm, allocate_node(mm, size));
+}
+
+static void free_node(mini_malloc* mm, memnode* node);
+
+// returns the number of bytes at the start of the given node which have to be split off as a
+// free node of their own, such that the rest of the node is aligned to alignment bytes
+static size_type get_align_padding(memnode* node, size_t alignment) {
+    byte* ptr = (byte*) node + ALLOC_NODE_SIZE;
+    if ((uintptr_t) ptr % alignment == 0) { return 0; }
+    // the padding has to be big enough to become a free node of its own
+    byte* aligned_ptr = ptr + ALLOC_NODE_SIZE + MIN_NODE_SIZE;
+    aligned_ptr += (alignment - (uintptr_t) aligned_ptr % alignment) % alignment;
+    return aligned_ptr - ptr;
+}
+
+// shrinks an allocated node, whose following node is not free, to size bytes starting
+// after padding bytes, see get_align_padding; returns the node at its new start
+static memnode* carve_node(mini_malloc* mm, memnode* node, size_type padding, size_t size) {
+    if (padding > 0) {
+        memnode* aligned_node = (memnode*) ((byte*) node + padding);
+        size_type padding_size = padding - ALLOC_NODE_SIZE;
+        aligned_node->size = node->size - padding;
+        aligned_node->prev_node_size = padding_size;
+        set_allocated(aligned_node);
+        set_prev_node_size(get_following_node(aligned_node), aligned_node->size);
+        node->size = padding_size;
+        // this merges the padding with a free node before it
+        free_node(mm, node);
+        node = aligned_node;
+    }
+    // give back the unused end of the block
+    split_node(mm, node, size);
+    return node;
+}
+
+void* structstore::mm_allocate_aligned(mini_malloc* mm, size_t size, size_t alignment) {
+    assert((alignment & (alignment - 1)) == 0);
+    if (alignment <= ALIGN) { return mm_allocate(mm, size); }
+    if (size == 0) return NULL;
+    // the largest padding that get_align_padding might return
+    size_t padding = alignment + ALLOC_NODE_SIZE + MIN_NODE_SIZE;
+    if (size > std::numeric_limits<size_type>::max() - ALIGN - padding) {
+        ++mm->failed_allocations;
+        return NULL;
+    }
+    memnode* node = allocate_node(mm, size + padding);
+    if (node == NULL) { return count_allocated_node(mm, NULL); }
+    // the node might have been split already, thus it is extended up to the next
+    // allocated node first, so that it can be split differently below
+    memnode* next_node = get_next_node(node);
+    if (next_node != NULL && !is_allocated(next_node)) { absorb_next_node(mm, node); }
+    if (size % ALIGN) { size += ALIGN - size % ALIGN; }
+    if (size < MIN_NODE_SIZE) { size = MIN_NODE_SIZE; }
+    node = carve_node(mm, node, get_align_padding(node, alignment), size);
+    return count_allocated_node(mm, node);
+}
+
+// keeps the given free node in best if it can hold the block below limit and is lower
+static void consider_low_node(memnode* node, size_t size, size_t alignment, const byte* limit,
+                              memnode** best) {
+    if (*best != NULL && node > *best) { return; }
+    size_type padding = get_align_padding(node, alignment);
+    if (node->size < padding + size) { return; }
+    if ((byte*) node + padding + ALLOC_NODE_SIZE >= limit) { return; }
+    *best = node;
+}
+
+static void find_low_tree_node(memnode* node, size_t size, size_t alignment, const byte* limit,
+                               memnode** best) {
+    while (node != NULL) {
+        if (node->size < size) {
+            // all nodes in the left subtree are smaller as well
+            node = get_right_node(node);
+            continue;
+        }
+        consider_low_node(node, size, alignment, limit, best);
+        find_low_tree_node(get_right_node(node), size, alignment, limit, best);
+        node = get_left_node(node);
+    }
+}
+
+void* structstore::mm_allocate_low(mini_malloc* mm, size_t size, size_t alignment,
+                                   const void* limit) {
+    assert((alignment & (alignment - 1)) == 0);
+    if (size == 0) return NULL;
+    if (alignment < ALIGN) { alignment = ALIGN; }
+    if (size > std::numeric_limits<size_type>::max() - ALIGN - alignment - 2 * ALLOC_NODE_SIZE) {
+        return NULL;
+    }
+    // the same rounding as in mm_allocate and mm_allocate_aligned, respectively
+    if (alignment == ALIGN) {
+        size = mm_alloc_size(size);
+    } else {
+        if (size % ALIGN) { size += ALIGN - size % ALIGN; }
+        if (size < MIN_NODE_SIZE) { size = MIN_NODE_SIZE; }
+    }
+    memnode* best = NULL;
+    size_index_type size_index = find_nonempty_bin(mm, get_size_index_lower(size));
+    for (; size_index < SIZES_COUNT - 1; size_index = find_nonempty_bin(mm, size_index + 1)) {
+        memnode* node = get_free_nodes_first(mm, size_index);
+        for (; node != NULL; node = get_next_free_node(node)) {
+            consider_low_node(node, size, alignment, (const byte*) limit, &best);
+        }
+    }
+    if (size_index == SIZES_COUNT - 1) {
+        find_low_tree_node(get_free_nodes_first(mm, size_index), size, alignment,
+                           (const byte*) limit, &best);
+    }
+    if (best == NULL) { return NULL; }
+    remove_free_node(mm, best);
+    set_allocated(best);
+    best = carve_node(mm, best, get_align_padding(best, alignment), size);
+    return count_allocated_node(mm, best);
+}
 
 static void join_with_next(mini_malloc* mm, memnode* node) {
     if (node == NULL || is_allocated(node)) { return; }
     memnode* next_node = get_next_node(node);
     if (next_node == NULL || is_allocated(next_node)) { return; }
-    node->size += next_node->size + ALLOC_NODE_SIZE;
-    assert(node->size % ALIGN == 0);
     // remove node from free nodes list:
-    attach_free_nodes(get_prev_free_node(node), get_next_free_node(node));
+    remove_free_node(mm, node);
     // remove next_node from nodes lists:
-    attach_free_nodes(get_prev_free_node(next_node), get_next_free_node(next_node));
+    remove_free_node(mm, next_node);
+    node->size += next_node->size + ALLOC_NODE_SIZE;
+    assert(node->size % ALIGN == 0);
 
-    next_node = get_next_node(node);
-    if (next_node != NULL) { set_prev_node_size(next_node, node->size); }
+    set_prev_node_size(get_following_node(node), node->size);
     // prepend node to free nodes list:
     size_index_type size_index = get_size_index_lower(node->size);
     prepend_free_node(mm, node, size_index);
 }
 
-void structstore::mm_free(mini_malloc* mm, const void* ptr) {
-    if (!ptr) return;
-
-    memnode* node = (memnode*) (((byte*) ptr) - ALLOC_NODE_SIZE);
+static void free_node(mini_malloc* mm, memnode* node) {
     assert(node->size % ALIGN == 0);
     size_index_type size_index = get_size_index_lower(node->size);
     set_unallocated(node);
@@ -288,6 +580,185 @@ void structstore::mm_free(mini_malloc* mm, const void* ptr) {
     join_with_next(mm, get_prev_node(node));
 }
 
+void structstore::mm_free(mini_malloc* mm, const void* ptr) {
+    if (!ptr) return;
+
+    memnode* node = (memnode*) (((byte*) ptr) - ALLOC_NODE_SIZE);
+    mm->used_bytes -= node->size;
+    --mm->allocation_count;
+    free_node(mm, node);
+}
+
+bool structstore::mm_resize(mini_malloc* mm, const void* ptr, size_t size) {
+    if (size > std::numeric_limits<size_type>::max() - ALIGN) { return false; }
+    // the same rounding as in allocate_node, so that the node fits its size class
+    size = mm_alloc_size(size == 0 ? 1 : size);
+    memnode* node = (memnode*) (((byte*) ptr) - ALLOC_NODE_SIZE);
+    size_type old_size = node->size;
+    memnode* next_node = get_next_node(node);
+    bool next_free = next_node != NULL && !is_allocated(next_node);
+    if (size > old_size &&
+        (!next_free || old_size + ALLOC_NODE_SIZE + next_node->size < size)) {
+        return false;
+    }
+    // take over the following free node, so that the rest is merged with it below
+    if (next_free) { absorb_next_node(mm, node); }
+    split_node(mm, node, size);
+    mm->used_bytes += node->size;
+    mm->used_bytes -= old_size;
+    if (mm->used_bytes > mm->high_water_bytes) { mm->high_water_bytes = mm->used_bytes; }
+    return true;
+}
+
+void* structstore::mm_realloc(mini_malloc* mm, void* ptr, size_t size) {
+    if (ptr == NULL) { return mm_allocate(mm, size); }
+    if (size == 0) {
+        mm_free(mm, ptr);
+        return NULL;
+    }
+    if (mm_resize(mm, ptr, size)) { return ptr; }
+    void* new_ptr = mm_allocate(mm, size);
+    if (new_ptr == NULL) { return NULL; }
+    size_t old_size = mm_block_size(ptr);
+    memcpy(new_ptr, ptr, old_size < size ? old_size : size);
+    mm_free(mm, ptr);
+    return new_ptr;
+}
+
+void structstore::mm_grow(mini_malloc* mm, size_t blocksize, size_t new_blocksize) {
+    assert(blocksize % ALIGN == 0 && new_blocksize % ALIGN == 0);
+    assert(new_blocksize >= blocksize + ALLOC_NODE_SIZE + MIN_NODE_SIZE);
+    assert(new_blocksize - sizeof(mini_malloc) <= std::numeric_limits<size_type>::max());
+    memnode* node = (memnode*) ((byte*) mm + blocksize - ALLOC_NODE_SIZE);
+    assert(node->size == 0 && is_allocated(node));
+    memnode* last_node = (memnode*) ((byte*) mm + new_blocksize - ALLOC_NODE_SIZE);
+    last_node->size = 0;
+    // the old end marker becomes an allocated node spanning the new memory, which is
+    // then freed to merge it with a free node before it
+    node->size = (byte*) last_node - (byte*) node - ALLOC_NODE_SIZE;
+    last_node->prev_node_size = node->size;
+    set_allocated(last_node);
+    free_node(mm, node);
+    mm->blocksize = new_blocksize;
+}
+
+size_t structstore::mm_alloc_size(size_t size) {
+    if (size == 0) { return 0; }
+    if (size % ALIGN) { size += ALIGN - size % ALIGN; }
+    if (size < MIN_NODE_SIZE) { size = MIN_NODE_SIZE; }
+    size_index_type size_index = get_size_index_upper(size);
+    if (size_index < SIZES_COUNT - 1) { return sizes[size_index]; }
+    return size;
+}
+
+size_t structstore::mm_block_size(const void* ptr) {
+    // only the size is read here, since the allocation flag shares its word with
+    // prev_node_size, which is modified when the previous node is merged
+    memnode* node = (memnode*) (((byte*) ptr) - ALLOC_NODE_SIZE);
+    return node->size;
+}
+
+static void add_tree_stats(memnode* node, size_t* free_bytes, size_t* largest_free_block) {
+    if (node == NULL) { return; }
+    *free_bytes += node->size;
+    if (node->size > *largest_free_block) { *largest_free_block = node->size; }
+    add_tree_stats(get_left_node(node), free_bytes, largest_free_block);
+    add_tree_stats(get_right_node(node), free_bytes, largest_free_block);
+}
+
+void structstore::mm_get_stats(mini_malloc* mm, mm_stats* stats) {
+    *stats = mm_stats{};
+    stats->total_bytes = mm->blocksize;
+    stats->used_bytes = mm->used_bytes;
+    stats->allocation_count = mm->allocation_count;
+    stats->high_water_bytes = mm->high_water_bytes;
+    stats->failed_allocations = mm->failed_allocations;
+    for (size_index_type size_index = 0; size_index < SIZES_COUNT; ++size_index) {
+        size_t& free_bytes = stats->class_free_bytes[size_index];
+        stats->class_sizes[size_index] = sizes[size_index];
+        memnode* node = get_free_nodes_first(mm, size_index);
+        if (size_index == SIZES_COUNT - 1) {
+            add_tree_stats(node, &free_bytes, &stats->largest_free_block);
+        } else {
+            for (; node != NULL; node = get_next_free_node(node)) {
+                free_bytes += node->size;
+                if (node->size > stats->largest_free_block) {
+                    stats->largest_free_block = node->size;
+                }
+            }
+        }
+        stats->free_bytes += free_bytes;
+    }
+    if (stats->free_bytes > 0) {
+        stats->fragmentation = 1.0 - (double) stats->largest_free_block / stats->free_bytes;
+    }
+}
+
+static bool is_node_in_block(mini_malloc* mm, memnode* node) {
+    byte* start = (byte*) mm + sizeof(mini_malloc);
+    byte* end = (byte*) mm + mm->blocksize - ALLOC_NODE_SIZE;
+    return (byte*) node >= start && (byte*) node < end &&
+           ((byte*) node - (byte*) mm) % ALIGN == 0;
+}
+
+// checks the nodes of the treap below node, which must lie between the bounds, and counts them
+static void check_tree_nodes(mini_malloc* mm, memnode* node, memnode* lower, memnode* upper,
+                             size_t* free_bytes, size_t* free_count, size_t max_count) {
+    if (node == NULL) { return; }
+    stst_assert(++*free_count <= max_count);
+    stst_assert(is_node_in_block(mm, node) && !is_allocated(node));
+    stst_assert(get_size_index_lower(node->size) == SIZES_COUNT - 1);
+    stst_assert(lower == NULL || is_less_node(lower, node));
+    stst_assert(upper == NULL || is_less_node(node, upper));
+    *free_bytes += node->size;
+    check_tree_nodes(mm, get_left_node(node), lower, node, free_bytes, free_count, max_count);
+    check_tree_nodes(mm, get_right_node(node), node, upper, free_bytes, free_count, max_count);
+}
+
+void structstore::mm_check(mini_malloc* mm) {
+    // all nodes in address order, which must link up to the end marker
+    size_t node_free_bytes = 0;
+    size_t node_free_count = 0;
+    memnode* node = (memnode*) ((byte*) mm + sizeof(mini_malloc));
+    memnode* end_node = (memnode*) ((byte*) mm + mm->blocksize - ALLOC_NODE_SIZE);
+    size_type prev_size = 0;
+    for (; node != end_node; node = get_following_node(node)) {
+        stst_assert(is_node_in_block(mm, node));
+        stst_assert(get_prev_node_size(node) == prev_size);
+        stst_assert(node->size > 0 && node->size % ALIGN == 0);
+        if (!is_allocated(node)) {
+            node_free_bytes += node->size;
+            ++node_free_count;
+        }
+        prev_size = node->size;
+    }
+    stst_assert(end_node->size == 0 && is_allocated(end_node));
+    stst_assert(get_prev_node_size(end_node) == prev_size);
+
+    // all free nodes must be in the list of their size class or in the treap
+    size_t list_free_bytes = 0;
+    size_t list_free_count = 0;
+    for (size_index_type size_index = 0; size_index < SIZES_COUNT; ++size_index) {
+        memnode* head = get_free_nodes_head(mm, size_index);
+        memnode* first = get_next_free_node(head);
+        stst_assert((first != NULL) == ((mm->nonempty_bins >> size_index) & 1));
+        if (size_index == SIZES_COUNT - 1) {
+            check_tree_nodes(mm, first, NULL, NULL, &list_free_bytes, &list_free_count,
+                             node_free_count);
+            break;
+        }
+        for (memnode* prev = head; first != NULL; prev = first, first = get_next_free_node(first)) {
+            stst_assert(++list_free_count <= node_free_count);
+            stst_assert(is_node_in_block(mm, first) && !is_allocated(first));
+            stst_assert(get_size_index_lower(first->size) == size_index);
+            stst_assert(get_prev_free_node(first) == prev);
+            list_free_bytes += first->size;
+        }
+    }
+    stst_assert(list_free_count == node_free_count);
+    stst_assert(list_free_bytes == node_free_bytes);
+}
+
 void structstore::mm_assert_all_freed(mini_malloc* mm) {
     memnode* block_node = (memnode*) ((byte*) mm + sizeof(mini_malloc));
     memnode* node = block_node;
@@ -43,6 +43,16 @@ NB_MODULE(MODULE_NAME, m) {
             .value("ALWAYS", ALWAYS)
             .export_values();
 
+    // map options are combined with |, thus they are plain ints in Python
+    m.attr("HUGE_PAGES") = (int) HUGE_PAGES;
+    m.attr("PREFAULT") = (int) PREFAULT;
+    m.attr("LOCK_MEMORY") = (int) LOCK_MEMORY;
+
+    nb::enum_<AllocMode>(m, "AllocMode")
+            .value("MINI_MALLOC", MINI_MALLOC)
+            .value("BUMP_POINTER", BUMP_POINTER)
+            .export_values();
+
     nb::enum_<Log::Level>(m, "LogLevel")
             .value("DEBUG", Log::Level::DEBUG)
             .value("INFO", Log::Level::INFO)
@@ -51,6 +61,13 @@ NB_MODULE(MODULE_NAME, m) {
             .export_values();
     m.def("set_log_level", [](Log::Level level) { Log::level = level; });
 
+    // see StructStoreShared.contended_locks
+    m.def("set_lock_instrumentation", &SpinMutex::set_instrumentation, nb::arg("enabled"));
+    m.def("reset_lock_stats", &SpinMutex::reset_stats);
+
+    m.def("set_writer_preference", &SpinMutex::set_writer_preference, nb::arg("enabled"));
+    m.def("get_lock_recoveries", &SpinMutex::get_recoveries);
+
     // structstore::StructStore
     nb::class_<StructStore::Ref> cls = nb::class_<StructStore::Ref>{m, "StructStore"};
     cls.def("__init__",
@@ -112,15 +129,22 @@ NB_MODULE(MODULE_NAME, m) {
     shcls.def(
             "__init__",
             [](StructStoreShared* s, const std::string& path, size_t size, bool reinit,
-               bool use_file, CleanupMode cleanup) {
-                new (s) StructStoreShared{path, size, reinit, use_file, cleanup};
+               bool use_file, CleanupMode cleanup, size_t max_size, int map_options,
+               AllocMode alloc_mode) {
+                new (s) StructStoreShared{path,    size,     reinit,      use_file,
+                                          cleanup, max_size, map_options, alloc_mode};
             },
             nb::arg("path"), nb::arg("size") = 4096, nb::arg("reinit") = false,
-            nb::arg("use_file") = false, nb::arg("cleanup") = IF_LAST);
+            nb::arg("use_file") = false, nb::arg("cleanup") = IF_LAST, nb::arg("max_size") = 0,
+            nb::arg("map_options") = 0, nb::arg("alloc_mode") = MINI_MALLOC);
     shcls.def(
             "__init__",
-            [](StructStoreShared* s, int fd, bool init) { new (s) StructStoreShared{fd, init}; },
-            nb::arg("fd"), nb::arg("init"));
+            [](StructStoreShared* s, int fd, bool init, int map_options) {
+                new (s) StructStoreShared{fd, init, map_options};
+            },
+            nb::arg("fd"), nb::arg("init"), nb::arg("map_options") = 0);
+    shcls.def_static("create_memfd", &StructStoreShared::create_memfd, nb::arg("name"),
+                     nb::arg("size"), nb::arg("map_options") = 0);
     shcls.def("valid", &StructStoreShared::valid);
     shcls.def(
             "revalidate",
@@ -140,7 +164,50 @@ NB_MODULE(MODULE_NAME, m) {
     shcls.def("from_bytes", [](StructStoreShared& shs, const nb::bytes& buffer) {
         shs.from_buffer((void*) buffer.c_str(), buffer.size());
     });
+    shcls.def("stats", [](StructStoreShared& shs) {
+        mm_stats stats = shs.stats();
+        nb::dict free_bytes_per_class;
+        for (size_t i = 0; i < MM_SIZE_CLASSES; ++i) {
+            free_bytes_per_class[nb::int_(stats.class_sizes[i])] = stats.class_free_bytes[i];
+        }
+        nb::dict dict;
+        dict["total_bytes"] = stats.total_bytes;
+        dict["used_bytes"] = stats.used_bytes;
+        dict["free_bytes"] = stats.free_bytes;
+        dict["largest_free_block"] = stats.largest_free_block;
+        dict["allocation_count"] = stats.allocation_count;
+        dict["high_water_bytes"] = stats.high_water_bytes;
+        dict["failed_allocations"] = stats.failed_allocations;
+        dict["fragmentation"] = stats.fragmentation;
+        dict["free_bytes_per_class"] = free_bytes_per_class;
+        return dict;
+    });
     shcls.def("close", &StructStoreShared::close);
+    shcls.def("reset", &StructStoreShared::reset);
+    shcls.def("reclaim_names", &StructStoreShared::reclaim_names);
+    shcls.def("compact", &StructStoreShared::compact);
+    shcls.def("compact_step", &StructStoreShared::compact_step, nb::arg("max_pause"));
+    shcls.def_prop_rw("lock_timeout", &StructStoreShared::get_lock_timeout,
+                      &StructStoreShared::set_lock_timeout);
+    shcls.def(
+            "contended_locks",
+            [](StructStoreShared& shs, size_t count) {
+                nb::list list;
+                for (const auto& [path, stats]: shs.contended_locks(count)) {
+                    nb::dict dict;
+                    dict["acquisitions"] = stats.acquisitions;
+                    dict["contended"] = stats.contended;
+                    dict["timeouts"] = stats.timeouts;
+                    dict["spins"] = stats.spins;
+                    dict["wait_nsecs"] = stats.wait_nsecs;
+                    dict["max_hold_nsecs"] = stats.max_hold_nsecs;
+                    dict["max_hold_tid"] = stats.max_hold_tid;
+                    dict["holder_tid"] = stats.holder_tid;
+                    list.append(nb::make_tuple(path, dict));
+                }
+                return list;
+            },
+            nb::arg("count") = 10);
     shcls.def_prop_ro("store", [](StructStoreShared& store) { return ref_wrap(*store); });
 
     // built-in field types:
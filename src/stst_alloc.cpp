@@ -1,6 +1,17 @@
 #include "structstore/stst_alloc.hpp"
 #include "structstore/stst_utils.hpp"
+
+#include <cerrno>
+#include <initializer_list>
 #include <limits>
+#include <mutex>
+#include <random>
+#include <unordered_map>
+#include <unordered_set>
+
+#include <pthread.h>
+#include <signal.h>
+#include <unistd.h>
 
 using namespace structstore;
 
@@ -19,45 +30,917 @@ static constexpr size_t static_alloc_size = 1 << 20;
 static ManagedSharedAlloc managed_static_alloc{static_alloc_size};
 SharedAlloc& structstore::static_alloc = *managed_static_alloc.sh_alloc;
 
-SharedAlloc::SharedAlloc(void* buffer, size_t size)
-    : mm{(mini_malloc*) buffer}, blocksize{(uint32_t) size}, string_storage{nullptr} {
+namespace structstore {
+
+// keeps track of the thread caches claimed by the current thread and of the
+// arenas which are still mapped in the current process
+class ThreadCacheRegistry {
+    static constexpr size_t MAX_REFS = 8;
+    static constexpr uint32_t NO_CACHE = UINT32_MAX;
+
+    struct Ref {
+        const SharedAlloc* sh_alloc;
+        uint32_t idx;
+        // for NO_CACHE, the value of detach_count() when the arena had no free cache
+        uint64_t detach_count;
+    };
+
+    uint64_t token = 0;
+    Ref refs[MAX_REFS] = {};
+    size_t ref_count = 0;
+
+    static std::mutex& mutex() {
+        static auto* mutex = new std::mutex();
+        return *mutex;
+    }
+
+    static std::unordered_set<const SharedAlloc*>& attached() {
+        static auto* attached = new std::unordered_set<const SharedAlloc*>();
+        return *attached;
+    }
+
+    // incremented whenever an arena is removed from attached(); the NO_CACHE refs of other
+    // threads cannot be dropped then, thus they are dropped when they see it changed, also
+    // since a new arena might have been created at the same address
+    static std::atomic_uint64_t& detach_count() {
+        static std::atomic_uint64_t count{0};
+        return count;
+    }
+
+    // arenas without a cache claimed by this process are not in attached(), but other threads
+    // might still have NO_CACHE refs to them
+    static void detach_arena(SharedAlloc& sh_alloc) {
+        attached().erase(&sh_alloc);
+        detach_count().fetch_add(1, std::memory_order_relaxed);
+    }
+
+    // drops the refs to arenas which were detached since; returns true if any were dropped
+    bool prune() {
+        uint64_t detached = detach_count().load(std::memory_order_relaxed);
+        std::lock_guard<std::mutex> lock{mutex()};
+        size_t kept = 0;
+        for (size_t i = 0; i < ref_count; ++i) {
+            const Ref& ref = refs[i];
+            bool live = ref.idx == NO_CACHE ? ref.detach_count == detached
+                                            : attached().count(ref.sh_alloc) != 0;
+            if (live) { refs[kept++] = ref; }
+        }
+        bool pruned = kept < ref_count;
+        ref_count = kept;
+        return pruned;
+    }
+
+    static ThreadCacheRegistry& local() {
+        static thread_local ThreadCacheRegistry registry;
+        return registry;
+    }
+
+    static void reset_after_fork() {
+        // the child process must not use the caches owned by the parent's threads
+        ThreadCacheRegistry& registry = local();
+        registry.token = 0;
+        registry.ref_count = 0;
+        attached().clear();
+    }
+
+    ThreadCacheRegistry() {
+        static bool registered_fork_handler = []() {
+            pthread_atfork(nullptr, nullptr, &ThreadCacheRegistry::reset_after_fork);
+            return true;
+        }();
+        (void) registered_fork_handler;
+    }
+
+    ~ThreadCacheRegistry() {
+        if (ref_count == 0) { return; }
+        std::lock_guard<std::mutex> lock{mutex()};
+        for (size_t i = 0; i < ref_count; ++i) {
+            SharedAlloc* sh_alloc = (SharedAlloc*) refs[i].sh_alloc;
+            if (refs[i].idx == NO_CACHE || attached().count(sh_alloc) == 0) { continue; }
+            if (refs[i].idx >= sh_alloc->thread_cache_count) { continue; }
+            ThreadCache& cache = sh_alloc->thread_caches[refs[i].idx];
+            if (cache.owner.load(std::memory_order_relaxed) != token) { continue; }
+            sh_alloc->flush_thread_cache(cache);
+            cache.owner.store(0, std::memory_order_release);
+        }
+    }
+
+    uint64_t get_token() {
+        if (token == 0) {
+            uint32_t tid;
+            do { tid = std::random_device{}(); } while (tid == 0);
+            token = ((uint64_t) getpid() << 32) | tid;
+        }
+        return token;
+    }
+
+    static bool is_owner_dead(uint64_t owner) {
+        pid_t pid = (pid_t) (owner >> 32);
+        return pid != getpid() && kill(pid, 0) == -1 && errno == ESRCH;
+    }
+
+    // takes over the cache of an exited process; its blocks are kept
+    bool reclaim(SharedAlloc& sh_alloc, ThreadCache& cache, uint64_t owner) {
+        if (!cache.owner.compare_exchange_strong(owner, get_token(), std::memory_order_acquire)) {
+            return false;
+        }
+        STST_LOG_DEBUG() << "reclaiming thread cache of exited process " << (owner >> 32);
+        sh_alloc.repair_thread_cache(cache);
+        cache.flush_requested.store(false, std::memory_order_relaxed);
+        return true;
+    }
+
+    ThreadCache* claim(SharedAlloc& sh_alloc, ThreadCache& cache, Ref& ref, uint32_t idx) {
+        {
+            std::lock_guard<std::mutex> lock{mutex()};
+            attached().insert(&sh_alloc);
+        }
+        ref.idx = idx;
+        return &cache;
+    }
+
+public:
+    static ThreadCache* get(SharedAlloc& sh_alloc) {
+        ThreadCacheRegistry& registry = local();
+        for (size_t i = 0; i < registry.ref_count; ++i) {
+            Ref& ref = registry.refs[i];
+            if (ref.sh_alloc != &sh_alloc) { continue; }
+            if (ref.idx == NO_CACHE &&
+                ref.detach_count == detach_count().load(std::memory_order_relaxed)) {
+                return nullptr;
+            }
+            if (ref.idx < sh_alloc.thread_cache_count) {
+                ThreadCache& cache = sh_alloc.thread_caches[ref.idx];
+                if (cache.owner.load(std::memory_order_relaxed) == registry.token) {
+                    if (cache.flush_requested.load(std::memory_order_relaxed)) {
+                        // a request arriving during the flush is served next time
+                        cache.flush_requested.store(false, std::memory_order_relaxed);
+                        sh_alloc.flush_thread_cache(cache);
+                    }
+                    return &cache;
+                }
+            }
+            // the cache was released in the meantime, or other caches might have become free
+            ref = registry.refs[--registry.ref_count];
+            break;
+        }
+        if (registry.ref_count == MAX_REFS && !registry.prune()) { return nullptr; }
+        uint64_t token = registry.get_token();
+        uint32_t count = sh_alloc.thread_cache_count;
+        Ref& ref = registry.refs[registry.ref_count++];
+        ref = Ref{&sh_alloc, NO_CACHE, detach_count().load(std::memory_order_relaxed)};
+        for (uint32_t i = 0; i < count; ++i) {
+            uint32_t idx = (uint32_t) ((token + i) % count);
+            ThreadCache& cache = sh_alloc.thread_caches[idx];
+            uint64_t expected = 0;
+            if (cache.owner.compare_exchange_strong(expected, token, std::memory_order_acquire)) {
+                cache.flush_requested.store(false, std::memory_order_relaxed);
+                return registry.claim(sh_alloc, cache, ref, idx);
+            }
+        }
+        // all caches are taken, but some owners might have exited without releasing theirs
+        for (uint32_t idx = 0; idx < count; ++idx) {
+            ThreadCache& cache = sh_alloc.thread_caches[idx];
+            uint64_t owner = cache.owner.load(std::memory_order_acquire);
+            if (owner != 0 && is_owner_dead(owner) && registry.reclaim(sh_alloc, cache, owner)) {
+                return registry.claim(sh_alloc, cache, ref, idx);
+            }
+        }
+        // this thread uses the arena directly
+        return nullptr;
+    }
+
+    // for arenas whose blocks are dropped at once; claimed caches become invalid, which
+    // the owning threads notice when they access them the next time
+    static void forget(SharedAlloc& sh_alloc) {
+        std::lock_guard<std::mutex> lock{mutex()};
+        detach_arena(sh_alloc);
+    }
+
+    // flushes the cache of the current thread and the caches of exited processes, and asks
+    // the other threads of the current process to flush theirs; their caches are used without
+    // synchronization, thus they cannot be flushed from here
+    static void flush(SharedAlloc& sh_alloc, bool release) {
+        ThreadCacheRegistry& registry = local();
+        std::lock_guard<std::mutex> lock{mutex()};
+        if (release) { detach_arena(sh_alloc); }
+        uint64_t pid = getpid();
+        for (uint32_t idx = 0; idx < sh_alloc.thread_cache_count; ++idx) {
+            ThreadCache& cache = sh_alloc.thread_caches[idx];
+            uint64_t owner = cache.owner.load(std::memory_order_acquire);
+            if (owner == 0) { continue; }
+            if (owner == registry.token) {
+                sh_alloc.flush_thread_cache(cache);
+                if (release) { cache.owner.store(0, std::memory_order_release); }
+            } else if ((owner >> 32) == pid) {
+                cache.flush_requested.store(true, std::memory_order_relaxed);
+            } else if (is_owner_dead(owner) && registry.reclaim(sh_alloc, cache, owner)) {
+                sh_alloc.flush_thread_cache(cache);
+                cache.owner.store(0, std::memory_order_release);
+            }
+        }
+    }
+
+    // for destroying the arena, when no other thread uses it anymore
+    static void release_all(SharedAlloc& sh_alloc) {
+        std::lock_guard<std::mutex> lock{mutex()};
+        detach_arena(sh_alloc);
+        for (uint32_t idx = 0; idx < sh_alloc.thread_cache_count; ++idx) {
+            ThreadCache& cache = sh_alloc.thread_caches[idx];
+            if (cache.owner.load(std::memory_order_acquire) == 0) { continue; }
+            sh_alloc.flush_thread_cache(cache);
+            cache.owner.store(0, std::memory_order_release);
+        }
+    }
+};
+
+// functions to grow the arenas which are mapped in the current process
+static std::mutex& grow_fns_mutex() {
+    static auto* mutex = new std::mutex();
+    return *mutex;
+}
+
+static std::unordered_map<const SharedAlloc*, SharedAlloc::GrowFn>& grow_fns() {
+    static auto* grow_fns = new std::unordered_map<const SharedAlloc*, SharedAlloc::GrowFn>();
+    return *grow_fns;
+}
+
+} // namespace structstore
+
+// set while the current thread compacts blocks of this arena, see SharedAlloc::CompactScope
+static thread_local const SharedAlloc* compacting_alloc = nullptr;
+
+SharedAlloc::CompactScope::CompactScope(const SharedAlloc& sh_alloc)
+    : prev_alloc{compacting_alloc} {
+    compacting_alloc = &sh_alloc;
+}
+
+SharedAlloc::CompactScope::~CompactScope() { compacting_alloc = prev_alloc; }
+
+SharedAlloc::SharedAlloc(void* buffer, size_t size, AllocMode mode)
+    : mm{(mini_malloc*) buffer}, blocksize{(arena_size_type) size}, string_storage{nullptr},
+      thread_caches{nullptr}, thread_cache_count{0}, slab_map{nullptr}, slab_map_size{0},
+      mode{mode}, bump_offset{0} {
     if (buffer == nullptr) { return; }
-    stst_assert(size < (1ull << 31));
+    stst_assert(size <= MAX_SIZE);
+    init_arena();
+}
+
+void SharedAlloc::init_arena() {
+    size_t size = blocksize;
+    thread_caches = nullptr;
+    thread_cache_count = 0;
+    slab_map = nullptr;
+    slab_map_size = 0;
+    for (OffsetPtr<Slab>& slab: partial_slabs) { slab = nullptr; }
+    if (mode == BUMP_POINTER) {
+        bump_offset = 0;
+        string_storage = allocate<StringStorage>();
+        new (string_storage.get()) StringStorage(*this);
+        return;
+    }
     init_mini_malloc(mm.get(), size);
+    if (size >= SLAB_ARENA_SIZE) {
+        // slabs are only created within the initial size of the arena
+        uint32_t map_size = size / Slab::SIZE + 1;
+        void* map = mm_allocate(mm.get(), map_size);
+        stst_assert(map != nullptr);
+        for (uint32_t idx = 0; idx < map_size; ++idx) {
+            new (&((std::atomic_uint8_t*) map)[idx]) std::atomic_uint8_t(0);
+        }
+        slab_map = (std::atomic_uint8_t*) map;
+        slab_map_size = map_size;
+    }
     string_storage = allocate<StringStorage>();
     new (string_storage.get()) StringStorage(*this);
+    uint32_t count = std::min<size_t>(size / THREAD_CACHE_ARENA_SIZE, MAX_THREAD_CACHES);
+    if (count > 0) {
+        thread_caches = allocate<ThreadCache>(count * sizeof(ThreadCache));
+        for (uint32_t idx = 0; idx < count; ++idx) { new (&thread_caches[idx]) ThreadCache(); }
+        thread_cache_count = count;
+    }
 }
 
 SharedAlloc::~SharedAlloc() noexcept(false) {
+    set_grow_fn({});
     string_storage->~StringStorage();
     deallocate(string_storage.get());
+    // blocks are never freed individually in this mode
+    if (mode == BUMP_POINTER) { return; }
+    if (thread_caches) {
+        ThreadCacheRegistry::release_all(*this);
+        thread_cache_count = 0;
+        mm_free(mm.get(), thread_caches.get());
+        thread_caches = nullptr;
+    }
+    if (slab_map) {
+        for (size_t size_class = 0; size_class < Slab::CLASSES; ++size_class) {
+            Slab* slab = partial_slabs[size_class].get();
+            while (slab != nullptr) {
+                Slab* next = slab->next.get();
+                // slabs with used slots are reported as leaked below
+                if (slab->used_count == 0) { destroy_slab(slab); }
+                slab = next;
+            }
+        }
+        mm_free(mm.get(), slab_map.get());
+        slab_map = nullptr;
+        slab_map_size = 0;
+    }
     mm_assert_all_freed(mm.get());
 }
 
+void SharedAlloc::detach() {
+    set_grow_fn({});
+    if (thread_caches) { ThreadCacheRegistry::forget(*this); }
+}
+
+void SharedAlloc::reset() {
+    STST_LOG_DEBUG() << "resetting arena at " << this;
+    detach();
+    init_arena();
+}
+
+void SharedAlloc::discard() {
+    STST_LOG_DEBUG() << "discarding arena at " << this;
+    detach();
+    thread_cache_count = 0;
+}
+
+ThreadCache* SharedAlloc::get_thread_cache() {
+    if (thread_cache_count == 0) { return nullptr; }
+    return ThreadCacheRegistry::get(*this);
+}
+
+size_t SharedAlloc::get_alloc_size(size_t size) const {
+    int size_class = slab_map ? Slab::get_class(size) : -1;
+    if (size_class >= 0) { return Slab::CLASS_SIZES[size_class]; }
+    return mm_alloc_size(size);
+}
+
+Slab* SharedAlloc::find_slab(const void* ptr) const {
+    if (!slab_map) { return nullptr; }
+    size_t offset = (const byte*) ptr - (const byte*) mm.get();
+    size_t window = offset / Slab::SIZE;
+    // the slab containing ptr starts either in the same or in the previous window
+    for (size_t idx: {window, window - 1}) {
+        // this also skips the previous window of the first one, which wraps around
+        if (idx >= slab_map_size) { continue; }
+        uint8_t entry = slab_map[idx].load(std::memory_order_relaxed);
+        if (entry == 0) { continue; }
+        size_t slab_offset = idx * Slab::SIZE + (entry - 1) * ALIGN;
+        if (slab_offset <= offset && offset < slab_offset + Slab::SIZE) {
+            return (Slab*) ((byte*) mm.get() + slab_offset);
+        }
+    }
+    return nullptr;
+}
+
+Slab* SharedAlloc::create_slab(int size_class) {
+    byte* ptr = (byte*) mm_allocate(mm.get(), Slab::SIZE);
+    if (ptr == nullptr) { return nullptr; }
+    size_t offset = ptr - (byte*) mm.get();
+    if (offset / Slab::SIZE >= slab_map_size) {
+        // this is in the grown part of the arena, which is not covered by the map
+        mm_free(mm.get(), ptr);
+        return nullptr;
+    }
+    Slab* slab = new (ptr) Slab();
+    slab->slot_size = Slab::CLASS_SIZES[size_class];
+    slab->slot_count = (Slab::SIZE - sizeof(Slab)) / slab->slot_size;
+    slab->used_count = 0;
+    slab->size_class = size_class;
+    for (size_t i = 0; i < 2; ++i) {
+        size_t first = i * 64;
+        if (slab->slot_count >= first + 64) {
+            slab->occupied[i] = 0;
+        } else if (slab->slot_count <= first) {
+            slab->occupied[i] = ~UINT64_C(0);
+        } else {
+            slab->occupied[i] = ~UINT64_C(0) << (slab->slot_count - first);
+        }
+    }
+    slab->next = partial_slabs[size_class].get();
+    slab->prev = nullptr;
+    if (slab->next) { slab->next->prev = slab; }
+    partial_slabs[size_class] = slab;
+    slab_map[offset / Slab::SIZE].store(offset % Slab::SIZE / ALIGN + 1, std::memory_order_relaxed);
+    return slab;
+}
+
+void SharedAlloc::destroy_slab(Slab* slab) {
+    if (slab->prev) {
+        slab->prev->next = slab->next.get();
+    } else {
+        partial_slabs[slab->size_class] = slab->next.get();
+    }
+    if (slab->next) { slab->next->prev = slab->prev.get(); }
+    size_t offset = (byte*) slab - (byte*) mm.get();
+    slab_map[offset / Slab::SIZE].store(0, std::memory_order_relaxed);
+    mm_free(mm.get(), slab);
+}
+
+void* SharedAlloc::allocate_locked(size_t size) {
+    int size_class = slab_map ? Slab::get_class(size) : -1;
+    if (size_class >= 0) {
+        Slab* slab = partial_slabs[size_class].get();
+        if (slab == nullptr) { slab = create_slab(size_class); }
+        if (slab != nullptr) {
+            size_t i = ~slab->occupied[0] != 0 ? 0 : 1;
+            size_t bit = __builtin_ctzll(~slab->occupied[i]);
+            slab->occupied[i] |= UINT64_C(1) << bit;
+            if (++slab->used_count == slab->slot_count) {
+                // full slabs are not kept in the list
+                partial_slabs[size_class] = slab->next.get();
+                if (slab->next) { slab->next->prev = nullptr; }
+                slab->next = nullptr;
+            }
+            return slab->slots() + (i * 64 + bit) * slab->slot_size;
+        }
+        // the slabs cannot grow, this falls back to a regular block
+    } else if (compacting_alloc == this) {
+        void* ptr = mm_allocate_low(mm.get(), size, ALIGN, (byte*) mm.get() + blocksize);
+        if (ptr != nullptr) { return ptr; }
+    }
+    return mm_allocate(mm.get(), size);
+}
+
+void SharedAlloc::deallocate_locked(const void* ptr) {
+    Slab* slab = find_slab(ptr);
+    if (slab == nullptr) {
+        mm_free(mm.get(), ptr);
+        return;
+    }
+    size_t idx = ((const byte*) ptr - slab->slots()) / slab->slot_size;
+    assert(slab->slots() + idx * slab->slot_size == ptr);
+    assert(slab->occupied[idx / 64] & (UINT64_C(1) << (idx % 64)));
+    slab->occupied[idx / 64] &= ~(UINT64_C(1) << (idx % 64));
+    OffsetPtr<Slab>& first = partial_slabs[slab->size_class];
+    if (slab->used_count-- == slab->slot_count) {
+        slab->prev = nullptr;
+        slab->next = first.get();
+        if (slab->next) { slab->next->prev = slab; }
+        first = slab;
+    } else if (slab->used_count == 0 && (first.get() != slab || slab->next)) {
+        // keeps one empty slab per size class to avoid repeated creation
+        destroy_slab(slab);
+    }
+}
+
+void* SharedAlloc::allocate_block(size_t size) {
+    if (mode == BUMP_POINTER) {
+        void* ptr = allocate_bump(size, ALIGN);
+        if (ptr == nullptr) {
+            ScopedLock<true> lock = lock_arena();
+            ptr = allocate_bump(size, ALIGN);
+            if (ptr == nullptr && grow(size)) { ptr = allocate_bump(size, ALIGN); }
+        }
+        return ptr;
+    }
+    size_t block_size = get_alloc_size(size);
+    ThreadCache* cache = nullptr;
+    if (block_size <= ThreadCache::MAX_SIZE && compacting_alloc != this) {
+        cache = get_thread_cache();
+    }
+    if (cache) {
+        size_t bin = block_size / ALIGN - 1;
+        if (cache->counts[bin] == 0) { refill_thread_cache(*cache, bin); }
+        if (cache->counts[bin] > 0) {
+            OffsetPtr<void, int64_t>& head = cache->heads[bin];
+            void* ptr = head.get();
+            head = ((OffsetPtr<void, int64_t>*) ptr)->get();
+            --cache->counts[bin];
+            return ptr;
+        }
+    }
+    ScopedLock<true> lock = lock_arena();
+    void* ptr = allocate_locked(size);
+    if (ptr == nullptr && cache) {
+        // blocks in our own cache might be able to satisfy the request when merged
+        lock.unlock();
+        flush_thread_cache(*cache);
+        lock = lock_arena();
+        ptr = allocate_locked(size);
+    }
+    if (ptr == nullptr && grow(size)) { ptr = allocate_locked(size); }
+    return ptr;
+}
+
+void* SharedAlloc::allocate_aligned_block(size_t size, size_t alignment) {
+    stst_assert(alignment > 0 && (alignment & (alignment - 1)) == 0);
+    if (alignment <= ALIGN) { return allocate_block(size); }
+    ScopedLock<true> lock = lock_arena();
+    if (mode == BUMP_POINTER) {
+        void* ptr = allocate_bump(size, alignment);
+        if (ptr == nullptr && grow(size + alignment)) { ptr = allocate_bump(size, alignment); }
+        return ptr;
+    }
+    void* ptr = mm_allocate_aligned(mm.get(), size, alignment);
+    if (ptr == nullptr && grow(size + 2 * alignment)) {
+        ptr = mm_allocate_aligned(mm.get(), size, alignment);
+    }
+    return ptr;
+}
+
+void* SharedAlloc::allocate_bump(size_t size, size_t alignment) {
+    if (size % ALIGN) { size += ALIGN - size % ALIGN; }
+    // the alignment refers to the address, not to the offset
+    size_t base = (size_t) mm.get();
+    arena_size_type offset = bump_offset.load(std::memory_order_relaxed);
+    size_t end;
+    do {
+        size_t start = (base + offset + alignment - 1) / alignment * alignment - base;
+        end = start + size;
+        if (end > blocksize || end < start) { return nullptr; }
+    } while (!bump_offset.compare_exchange_weak(offset, (arena_size_type) end,
+                                                std::memory_order_relaxed));
+    return (byte*) mm.get() + end - size;
+}
+
+bool SharedAlloc::grow(size_t size) {
+    GrowFn grow_fn;
+    {
+        std::lock_guard<std::mutex> lock{grow_fns_mutex()};
+        auto it = grow_fns().find(this);
+        if (it == grow_fns().end()) { return false; }
+        grow_fn = it->second;
+    }
+    size_t old_size = blocksize;
+    // mini_malloc only takes free nodes of the size class above the requested size
+    if (mode == MINI_MALLOC) { size = mm_alloc_size(size); }
+    size_t new_size = grow_fn(old_size, size);
+    // the new memory needs to hold at least one node
+    if (new_size < old_size + 4 * ALIGN) { return false; }
+    stst_assert(new_size <= MAX_SIZE && new_size % ALIGN == 0);
+    if (mode == MINI_MALLOC) { mm_grow(mm.get(), old_size, new_size); }
+    blocksize = new_size;
+    STST_LOG_DEBUG() << "grew arena at " << this << " to " << new_size << " bytes";
+    return true;
+}
+
+ScopedLock<true> SharedAlloc::lock_arena() const {
+    ScopedLock<true> lock{mutex};
+    if (mutex.is_suspect()) {
+        // a process died while holding the lock, possibly in the middle of an operation
+        if (mode == MINI_MALLOC) { mm_check(mm.get()); }
+        mutex.clear_suspect();
+    }
+    return lock;
+}
+
+mm_stats SharedAlloc::stats() const {
+    mm_stats stats;
+    if (mode == BUMP_POINTER) {
+        stats = mm_stats{};
+        stats.total_bytes = blocksize;
+        stats.used_bytes = bump_offset;
+        stats.high_water_bytes = stats.used_bytes;
+        stats.free_bytes = stats.total_bytes - stats.used_bytes;
+        stats.largest_free_block = stats.free_bytes;
+        return stats;
+    }
+    ScopedLock<true> lock = lock_arena();
+    mm_get_stats(mm.get(), &stats);
+    return stats;
+}
+
+void SharedAlloc::set_grow_fn(GrowFn grow_fn) {
+    std::lock_guard<std::mutex> lock{grow_fns_mutex()};
+    if (grow_fn) {
+        grow_fns()[this] = std::move(grow_fn);
+    } else {
+        grow_fns().erase(this);
+    }
+}
+
+void SharedAlloc::deallocate(const void* ptr) {
+    STST_LOG_DEBUG() << "deallocating at " << ptr;
+    if (ptr == nullptr || mode == BUMP_POINTER) { return; }
+    Slab* slab = find_slab(ptr);
+    size_t block_size = slab ? slab->slot_size : mm_block_size(ptr);
+    // blocks with excess size are not cached since they would never be reused
+    if (block_size <= ThreadCache::MAX_SIZE && get_alloc_size(block_size) == block_size &&
+        compacting_alloc != this) {
+        if (ThreadCache* cache = get_thread_cache()) {
+            size_t bin = block_size / ALIGN - 1;
+            OffsetPtr<void, int64_t>& head = cache->heads[bin];
+            new ((void*) ptr) OffsetPtr<void, int64_t>(head.get());
+            head = (void*) ptr;
+            if (++cache->counts[bin] > ThreadCache::MAX_COUNT) {
+                flush_thread_cache(*cache, bin, ThreadCache::REFILL_COUNT);
+            }
+            return;
+        }
+    }
+    ScopedLock<true> lock = lock_arena();
+    deallocate_locked(ptr);
+}
+
+bool SharedAlloc::resize(void* ptr, size_t size) {
+    STST_LOG_DEBUG() << "resizing at " << ptr << " to " << size;
+    // the size of blocks is not known in BUMP_POINTER mode
+    if (ptr == nullptr || mode == BUMP_POINTER) { return false; }
+    // slots cannot be resized, but they can hold anything up to their size
+    if (Slab* slab = find_slab(ptr)) { return size <= slab->slot_size; }
+    ScopedLock<true> lock = lock_arena();
+    return mm_resize(mm.get(), ptr, size);
+}
+
+void* SharedAlloc::reallocate(void* ptr, size_t size, size_t used_size) {
+    if (ptr == nullptr) { return allocate(size); }
+    if (resize(ptr, size)) { return ptr; }
+    if (mode == BUMP_POINTER) {
+        // the block might be followed by blocks of other threads, which must not be copied
+        if (used_size == UNKNOWN_SIZE) {
+            throw std::runtime_error("reallocate needs the used size in BUMP_POINTER mode");
+        }
+        void* new_ptr = allocate(size);
+        std::memcpy(new_ptr, ptr, std::min(used_size, size));
+        return new_ptr;
+    }
+    Slab* slab = find_slab(ptr);
+    size_t old_size = slab ? slab->slot_size : mm_block_size(ptr);
+    void* new_ptr = allocate(size);
+    std::memcpy(new_ptr, ptr, std::min({old_size, used_size, size}));
+    deallocate(ptr);
+    return new_ptr;
+}
+
+void* SharedAlloc::compact_block(void* ptr, size_t alignment) {
+    if (ptr == nullptr || mode == BUMP_POINTER || find_slab(ptr) != nullptr) { return ptr; }
+    ScopedLock<true> lock = lock_arena();
+    size_t size = mm_block_size(ptr);
+    void* new_ptr = mm_allocate_low(mm.get(), size, alignment, ptr);
+    if (new_ptr == nullptr) { return ptr; }
+    STST_LOG_DEBUG() << "moving block from " << ptr << " to " << new_ptr;
+    std::memcpy(new_ptr, ptr, size);
+    mm_free(mm.get(), ptr);
+    return new_ptr;
+}
+
+void SharedAlloc::refill_thread_cache(ThreadCache& cache, size_t bin) {
+    size_t block_size = (bin + 1) * ALIGN;
+    OffsetPtr<void, int64_t>& head = cache.heads[bin];
+    ScopedLock<true> lock = lock_arena();
+    while (cache.counts[bin] < ThreadCache::REFILL_COUNT) {
+        void* ptr = allocate_locked(block_size);
+        if (ptr == nullptr) { break; }
+        new (ptr) OffsetPtr<void, int64_t>(head.get());
+        head = ptr;
+        ++cache.counts[bin];
+    }
+}
+
+void SharedAlloc::flush_thread_cache(ThreadCache& cache, size_t bin, uint16_t keep_count) {
+    OffsetPtr<void, int64_t>& head = cache.heads[bin];
+    ScopedLock<true> lock = lock_arena();
+    while (cache.counts[bin] > keep_count) {
+        void* ptr = head.get();
+        head = ((OffsetPtr<void, int64_t>*) ptr)->get();
+        --cache.counts[bin];
+        deallocate_locked(ptr);
+    }
+}
+
+void SharedAlloc::flush_thread_cache(ThreadCache& cache) {
+    for (size_t bin = 0; bin < ThreadCache::BINS; ++bin) {
+        if (cache.counts[bin] > 0) { flush_thread_cache(cache, bin, 0); }
+    }
+}
+
+void SharedAlloc::repair_thread_cache(ThreadCache& cache) {
+    for (size_t bin = 0; bin < ThreadCache::BINS; ++bin) {
+        uint16_t count = 0;
+        OffsetPtr<void, int64_t>* link = &cache.heads[bin];
+        while (link->get() != nullptr) {
+            // a list never grows beyond MAX_COUNT + 1 blocks, see deallocate
+            if (count > ThreadCache::MAX_COUNT || !is_owned(link->get())) {
+                *link = nullptr;
+                break;
+            }
+            link = (OffsetPtr<void, int64_t>*) link->get();
+            ++count;
+        }
+        cache.counts[bin] = count;
+    }
+}
+
+void SharedAlloc::flush_thread_caches() {
+    if (thread_cache_count == 0) { return; }
+    ThreadCacheRegistry::flush(*this, false);
+}
+
+void SharedAlloc::release_thread_caches() {
+    if (thread_cache_count == 0) { return; }
+    ThreadCacheRegistry::flush(*this, true);
+}
+
+Compaction::Compaction(const void* base, double max_pause, size_t cursor)
+    : unbounded{std::isinf(max_pause)}, base{(const uint8_t*) base}, cursor{cursor} {
+    if (unbounded) {
+        deadline = clock::time_point::max();
+    } else {
+        deadline = clock::now() + std::chrono::duration_cast<clock::duration>(
+                                          std::chrono::duration<double>(max_pause));
+    }
+}
+
+void Compaction::run(const std::function<void(Compaction&)>& walk) {
+    walk(*this);
+    collecting = false;
+    std::sort(offsets.begin(), offsets.end());
+    size_t begin = 0;
+    size_t count = 1;
+    while (begin < offsets.size()) {
+        size_t end = unbounded ? offsets.size() : std::min(offsets.size(), begin + count);
+        window_begin = offsets[begin];
+        window_end = end < offsets.size() ? offsets[end] : std::numeric_limits<size_t>::max();
+        window_left = end - begin;
+        walk(*this);
+        begin = end;
+        count *= 2;
+        if (begin < offsets.size() && clock::now() >= deadline) {
+            cursor = offsets[begin];
+            return;
+        }
+    }
+    cursor = 0;
+}
+
+bool Compaction::next(const void* block) {
+    size_t offset = (const uint8_t*) block - base;
+    if (collecting) {
+        if (offset >= cursor) { offsets.push_back(offset); }
+        return false;
+    }
+    if (offset < window_begin || offset >= window_end) { return false; }
+    --window_left;
+    return true;
+}
+
 StringStorage::StringStorage(SharedAlloc& sh_alloc)
-    : map{StlAllocator<int>(sh_alloc)}, data{StlAllocator<int>(sh_alloc)} {
-    // element 0 is none
-    data.emplace_back();
+    : sh_alloc{&sh_alloc}, generation{std::random_device{}()} {
+    rebuild_table();
+    // element 0 is none and always in use
+    Entry& entry = create_entry(0);
+    new (&entry.str) shr_string(StlAllocator<char>{sh_alloc});
+    entry.hash = hash("");
+    new (&entry.refs) std::atomic_uint32_t(1);
+    entry.next_free = 0;
+    live_count = 1;
+    count.store(1, std::memory_order_release);
+}
+
+StringStorage::~StringStorage() {
+    uint32_t size = count.load(std::memory_order_relaxed);
+    for (shr_string_idx idx = 0; idx < size; ++idx) {
+        Entry& entry = get_entry(idx);
+        if (entry.refs.load(std::memory_order_relaxed) != FREE) { entry.str.~shr_string(); }
+    }
+    for (OffsetPtr<Entry>& chunk: chunks) {
+        if (chunk) { sh_alloc->deallocate(chunk.get()); }
+    }
+    Table* table = get_table();
+    while (table != nullptr) {
+        Table* prev = table->prev.get();
+        sh_alloc->deallocate(table);
+        table = prev;
+    }
 }
 
-shr_string_idx StringStorage::internalize(const std::string& str, SharedAlloc& sh_alloc) {
-    if (shr_string_idx found_idx = get_idx(str, sh_alloc)) { return found_idx; }
-    shr_string str_{str, StlAllocator{sh_alloc}};
+void StringStorage::rebuild_table() {
+    uint64_t size = 32;
+    while (size < 4 * ((uint64_t) live_count + 1)) { size *= 2; }
+    auto* table = (Table*) sh_alloc->allocate(sizeof(Table) + size * sizeof(std::atomic_uint64_t));
+    new (table) Table{};
+    table->mask = size - 1;
+    table->used = 0;
+    for (uint64_t i = 0; i < size; ++i) { new (&table->slots()[i]) std::atomic_uint64_t(0); }
+    uint32_t entry_count = count.load(std::memory_order_relaxed);
+    for (shr_string_idx idx = 1; idx < entry_count; ++idx) {
+        Entry& entry = get_entry(idx);
+        if (entry.refs.load(std::memory_order_relaxed) != FREE) {
+            insert_slot(*table, entry.hash, idx);
+        }
+    }
+    // the new table is filled completely before readers can see it
+    if (table_offset.load(std::memory_order_relaxed) != 0) { table->prev = get_table(); }
+    table_offset.store((uint8_t*) table - (uint8_t*) this, std::memory_order_release);
+}
+
+void StringStorage::insert_slot(Table& table, uint32_t hash, shr_string_idx idx) {
+    uint64_t i = hash & table.mask;
+    uint64_t slot;
+    while ((slot = table.slots()[i].load(std::memory_order_relaxed)) != 0 &&
+           slot != Table::TOMBSTONE) {
+        i = (i + 1) & table.mask;
+    }
+    if (slot == 0) { ++table.used; }
+    table.slots()[i].store(((uint64_t) hash << 32) | idx, std::memory_order_release);
+}
+
+StringStorage::Entry& StringStorage::get_entry(shr_string_idx idx) const {
+    size_t chunk = 63 - __builtin_clzll(idx / FIRST_CHUNK_SIZE + 1);
+    return chunks[chunk].get()[idx - FIRST_CHUNK_SIZE * ((UINT64_C(1) << chunk) - 1)];
+}
+
+StringStorage::Entry& StringStorage::create_entry(shr_string_idx idx) {
+    size_t chunk = 63 - __builtin_clzll(idx / FIRST_CHUNK_SIZE + 1);
+    if (!chunks[chunk]) {
+        // this happens before the index is published to readers
+        size_t size = FIRST_CHUNK_SIZE << chunk;
+        chunks[chunk] = sh_alloc->allocate<Entry>(size * sizeof(Entry));
+    }
+    return get_entry(idx);
+}
+
+shr_string_idx StringStorage::internalize(std::string_view str) {
+    uint32_t h = hash(str);
+    shr_string_idx idx = get_idx(str, h);
+    // a string without references is only dropped by reclaim, which excludes this
+    if (idx != 0) {
+        get_entry(idx).refs.fetch_add(1, std::memory_order_relaxed);
+        return idx;
+    }
     ScopedLock<true> lock{mutex};
-    auto [it, inserted] = map.emplace(str_, 0);
-    if (inserted) {
-        it->second = data.size();
-        data.emplace_back(str_);
+    // another writer might have inserted it in the meantime
+    idx = get_idx(str, h);
+    if (idx != 0) {
+        get_entry(idx).refs.fetch_add(1, std::memory_order_relaxed);
+        return idx;
+    }
+    uint32_t entry_count = count.load(std::memory_order_relaxed);
+    Entry* entry;
+    if (first_free != 0) {
+        idx = first_free;
+        entry = &get_entry(idx);
+        first_free = entry->next_free;
+    } else {
+        if (entry_count == std::numeric_limits<shr_string_idx>::max()) {
+            throw std::runtime_error("too many different strings in StringStorage");
+        }
+        idx = entry_count;
+        entry = &create_entry(idx);
+    }
+    new (&entry->str) shr_string(str, StlAllocator<char>{*sh_alloc});
+    entry->hash = h;
+    entry->next_free = 0;
+    new (&entry->refs) std::atomic_uint32_t(1);
+    ++live_count;
+    if (idx == entry_count) { count.store(entry_count + 1, std::memory_order_release); }
+    Table* table = get_table();
+    if (2 * (table->used + 1) > table->mask + 1) {
+        // the new table already contains the new entry
+        rebuild_table();
+    } else {
+        insert_slot(*table, h, idx);
     }
-    return it->second;
+    return idx;
+}
+
+void StringStorage::release(shr_string_idx idx) {
+    if (idx == 0) { return; }
+    uint32_t refs = get_entry(idx).refs.fetch_sub(1, std::memory_order_relaxed);
+    stst_assert(refs != 0 && refs != FREE);
 }
 
-shr_string_idx StringStorage::get_idx(const std::string& str, SharedAlloc& sh_alloc) const {
-    shr_string str_{str, StlAllocator{sh_alloc}};
-    ScopedLock<false> lock{mutex};
-    auto it = map.find(str_);
-    if (it != map.end()) { return it->second; }
-    return 0;
+size_t StringStorage::reclaim() {
+    ScopedLock<true> lock{mutex};
+    Table* table = get_table();
+    // no reader can probe the old tables anymore
+    while (Table* prev = table->prev.get()) {
+        table->prev = prev->prev.get();
+        sh_alloc->deallocate(prev);
+    }
+    size_t reclaimed = 0;
+    for (uint64_t i = 0; i <= table->mask; ++i) {
+        uint64_t slot = table->slots()[i].load(std::memory_order_relaxed);
+        if (slot == 0 || slot == Table::TOMBSTONE) { continue; }
+        auto idx = (shr_string_idx) slot;
+        Entry& entry = get_entry(idx);
+        if (entry.refs.load(std::memory_order_relaxed) != 0) { continue; }
+        table->slots()[i].store(Table::TOMBSTONE, std::memory_order_relaxed);
+        entry.str.~shr_string();
+        entry.refs.store(FREE, std::memory_order_relaxed);
+        entry.next_free = first_free;
+        first_free = idx;
+        --live_count;
+        ++reclaimed;
+    }
+    // the dropped indices can be reused for other strings
+    if (reclaimed > 0) { generation.fetch_add(1, std::memory_order_release); }
+    STST_LOG_DEBUG() << "reclaimed " << reclaimed << " strings in StringStorage at " << this;
+    return reclaimed;
 }
 
-const shr_string* StringStorage::get(shr_string_idx idx) const { return &data[idx]; }
+shr_string_idx StringStorage::get_idx(std::string_view str, uint32_t hash) const {
+    // the table has empty slots, thus this terminates
+    Table* table = get_table();
+    for (uint64_t i = hash & table->mask;; i = (i + 1) & table->mask) {
+        uint64_t slot = table->slots()[i].load(std::memory_order_acquire);
+        if (slot == 0) { return 0; }
+        if ((slot >> 32) != hash || slot == Table::TOMBSTONE) { continue; }
+        auto idx = (shr_string_idx) slot;
+        if (std::string_view(*get(idx)) == str) { return idx; }
+    }
+}
@@ -13,6 +13,16 @@ void String::check(const SharedAlloc* sh_alloc) const {
     if (sh_alloc && !empty()) { stst_assert(sh_alloc->is_owned(data())); }
 }
 
+void String::compact(Compaction& compaction) {
+    // short strings are stored within the object
+    const char* ptr = data();
+    if (ptr >= (const char*) this && ptr < (const char*) (this + 1)) { return; }
+    if (!compaction.next(ptr)) { return; }
+    SharedAlloc::CompactScope scope{get_allocator().get_alloc()};
+    shr_string copy{*this, get_allocator()};
+    if (copy.data() < ptr) { swap(copy); }
+}
+
 String& String::operator=(const std::string& value) {
     static_cast<shr_string&>(*this) = value;
     return *this;
@@ -49,6 +59,29 @@ void List::check(const SharedAlloc* sh_alloc) const {
     for (const Field& field: data) { field.check(*sh_alloc, *this); }
 }
 
+void List::compact(Compaction& compaction) {
+    if (data.data() && compaction.next(data.data())) { data.compact(); }
+    for (Field& field: data) {
+        if (compaction.stopped()) { return; }
+        field.compact(compaction);
+    }
+}
+
+void List::collect_lock_stats(LockStatsCollector& collector) const {
+    collector.add(mutex);
+    for (size_t idx = 0; idx < data.size(); ++idx) {
+        size_t length = collector.enter(idx);
+        data[idx].collect_lock_stats(collector);
+        collector.leave(length);
+    }
+}
+
+size_t List::reclaim_names() {
+    size_t reclaimed = 0;
+    for (Field& field: data) { reclaimed += field.reclaim_names(); }
+    return reclaimed;
+}
+
 bool List::operator==(const List& other) const {
     return data == other.data;
 }
@@ -79,7 +112,16 @@ void Matrix::check(const SharedAlloc* sh_alloc) const {
         // use our own reference instead
         sh_alloc = this->sh_alloc.get();
     }
-    if (_data) { stst_assert(sh_alloc->is_owned(_data.get())); }
+    if (_data) {
+        stst_assert(sh_alloc->is_owned(_data.get()));
+        stst_assert((size_t) _data.get() % _alignment == 0);
+    }
+}
+
+void Matrix::compact(Compaction& compaction) {
+    if (_data && compaction.next(_data.get())) {
+        _data = (double*) sh_alloc->compact_block(_data.get(), _alignment);
+    }
 }
 
 bool Matrix::operator==(const Matrix& other) const {
@@ -59,3 +59,13 @@ template<>
 ::structstore::String& FieldAccess<true>::get_str() {
     return get<::structstore::String>();
 }
+
+template<bool managed>
+void FieldAccess<managed>::clear() {
+    field.clear(sh_alloc);
+    if (field_map) { field_map->invalidate_handles(); }
+}
+
+template void FieldAccess<false>::clear();
+
+template void FieldAccess<true>::clear();
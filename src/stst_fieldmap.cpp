@@ -26,19 +26,31 @@ bool FieldMapBase::operator==(const FieldMapBase& other) const {
 }
 
 Field* FieldMapBase::try_get_field(const std::string& name) {
-    shr_string_idx name_idx = sh_alloc->strings().get_idx(name, *sh_alloc);
+    shr_string_idx name_idx = sh_alloc->strings().get_idx(name);
     auto it = fields.find(name_idx);
     if (it == fields.end()) { return nullptr; }
     return &it->second;
 }
 
 const Field* FieldMapBase::try_get_field(const std::string& name) const {
-    shr_string_idx name_idx = sh_alloc->strings().get_idx(name, *sh_alloc);
+    shr_string_idx name_idx = sh_alloc->strings().get_idx(name);
     auto it = fields.find(name_idx);
     if (it == fields.end()) { return nullptr; }
     return &it->second;
 }
 
+Field* FieldMapBase::try_get_field(const FieldKey& key) {
+    auto it = fields.find(key.get_idx(sh_alloc->strings()));
+    if (it == fields.end()) { return nullptr; }
+    return &it->second;
+}
+
+const Field* FieldMapBase::try_get_field(const FieldKey& key) const {
+    auto it = fields.find(key.get_idx(sh_alloc->strings()));
+    if (it == fields.end()) { return nullptr; }
+    return &it->second;
+}
+
 void FieldMapBase::to_text(std::ostream& os) const {
     STST_LOG_DEBUG() << "serializing StructStore at " << this;
     os << "{";
@@ -65,12 +77,14 @@ void FieldMapBase::check(const SharedAlloc* sh_alloc, const FieldTypeBase& paren
     CallstackEntry entry{"structstore::FieldMap::check()"};
     if (sh_alloc) {
         stst_assert(this->sh_alloc.get() == sh_alloc);
+        // this could be allocated on regular stack/heap if the owning StructStore is not in
+        // shared mem
+        stst_assert(sh_alloc == &static_alloc || sh_alloc->is_owned(this));
     } else {
-        // use our own reference instead
+        // use our own reference instead; the map of a store with a sub-arena resides in the
+        // parent arena
         sh_alloc = this->sh_alloc.get();
     }
-    // this could be allocated on regular stack/heap if the owning StructStore is not in shared mem
-    stst_assert(sh_alloc == &static_alloc || sh_alloc->is_owned(this));
     if (slots.size() != fields.size()) {
         throw std::runtime_error("in FieldMap: slots and fields with different size");
     }
@@ -83,6 +97,28 @@ void FieldMapBase::check(const SharedAlloc* sh_alloc, const FieldTypeBase& paren
     }
 }
 
+void FieldMapBase::compact(Compaction& compaction) {
+    if (slots.data() && compaction.next(slots.data())) { slots.compact(); }
+    for (auto& [idx, value]: fields) {
+        if (compaction.stopped()) { return; }
+        value.compact(compaction);
+    }
+}
+
+void FieldMapBase::collect_lock_stats(LockStatsCollector& collector) const {
+    for (shr_string_idx name_idx: slots) {
+        size_t length = collector.enter(*sh_alloc->strings().get(name_idx));
+        fields.at(name_idx).collect_lock_stats(collector);
+        collector.leave(length);
+    }
+}
+
+size_t FieldMapBase::reclaim_names() {
+    size_t reclaimed = 0;
+    for (auto& [idx, value]: fields) { reclaimed += value.reclaim_names(); }
+    return reclaimed;
+}
+
 template<>
 void FieldMap<false>::copy_from_unmanaged(const FieldMap<false>& other) {
     // unmanaged copy: slots have to be the same
@@ -104,8 +140,7 @@ void FieldMap<true>::copy_from_managed(const FieldMap<true>& other,
     clear();
     for (shr_string_idx name_idx_other: other.get_slots()) {
         const shr_string* name_other = other.sh_alloc->strings().get(name_idx_other);
-        shr_string_idx name_idx =
-                sh_alloc->strings().internalize(std::string(*name_other), *sh_alloc);
+        shr_string_idx name_idx = sh_alloc->strings().internalize(*name_other);
         slots.emplace_back(name_idx);
         Field& field = fields.emplace(name_idx, Field{}).first->second;
         field.construct_copy_from(*sh_alloc, other.fields.at(name_idx_other), parent_field);
@@ -113,9 +148,24 @@ void FieldMap<true>::copy_from_managed(const FieldMap<true>& other,
 }
 
 template<>
-Field& FieldMap<true>::get_or_insert(const std::string& name) {
-    shr_string_idx name_idx = sh_alloc->strings().internalize(name, *sh_alloc);
+Field& FieldMap<true>::get_or_insert(std::string_view name) {
+    shr_string_idx name_idx = sh_alloc->strings().internalize(name);
     auto [it, inserted] = fields.emplace(name_idx, Field{});
-    if (inserted) { slots.emplace_back(name_idx); }
+    if (inserted) {
+        slots.emplace_back(name_idx);
+    } else {
+        sh_alloc->strings().release(name_idx);
+    }
     return it->second;
 }
+
+template<>
+Field& FieldMap<true>::get_or_insert(const FieldKey& key) {
+    // existing fields are found without touching the StringStorage
+    shr_string_idx name_idx = key.get_idx(sh_alloc->strings());
+    if (name_idx != 0) {
+        auto it = fields.find(name_idx);
+        if (it != fields.end()) { return it->second; }
+    }
+    return get_or_insert(key.get_name());
+}
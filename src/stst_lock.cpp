@@ -2,95 +2,981 @@
 #include "structstore/stst_typing.hpp"
 #include "structstore/stst_utils.hpp"
 
+#include <algorithm>
 #include <chrono>
+#include <cerrno>
+#include <climits>
+#include <fstream>
+#include <iterator>
+#include <mutex>
 #include <random>
+#include <shared_mutex>
+#include <sstream>
 #include <stdexcept>
 #include <thread>
+#include <unordered_map>
+
+#ifdef __linux__
+#include <linux/futex.h>
+#include <pthread.h>
+#include <signal.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
 
 using namespace structstore;
 
 thread_local uint32_t SpinMutex::tid = std::random_device{}();
 
-#define TIMEOUT_CHECK_INIT                                                                         \
-    int cnt = 0;                                                                                   \
-    double start_time = 0.0;
-
-#define TIMEOUT_CHECK(lock_type)                                                                   \
-    do {                                                                                           \
-        ++cnt;                                                                                     \
-        if (cnt > 1'000'000) {                                                                     \
-            std::this_thread::yield();                                                             \
-            cnt = 0;                                                                               \
-            double now = std::chrono::duration<double>(                                            \
-                                 std::chrono::steady_clock::now().time_since_epoch())              \
-                                 .count();                                                         \
-            if (start_time == 0.0) {                                                               \
-                start_time = now;                                                                  \
-            } else {                                                                               \
-                if (now - start_time > 0.1) {                                                      \
-                    throw std::runtime_error("timeout while getting " lock_type);                  \
-                }                                                                                  \
-            }                                                                                      \
-        }                                                                                          \
-    } while (0)
+std::atomic<SpinMutex::WaitMode> SpinMutex::wait_mode{SpinMutex::FUTEX};
 
-void SpinMutex::read_lock() {
+void SpinMutex::set_wait_mode(WaitMode mode) { wait_mode.store(mode); }
+
+std::atomic_bool SpinMutex::writer_preference{false};
+
+void SpinMutex::set_writer_preference(bool enabled) { writer_preference.store(enabled); }
+
+std::atomic_uint64_t SpinMutex::recoveries{0};
+
+uint64_t SpinMutex::get_recoveries() { return recoveries.load(); }
+
+#ifdef __linux__
+// reads the state and the start time of the given process from /proc; returns false if this
+// is not possible, e.g. since the process does not exist
+static bool read_process_stat(pid_t pid, char& proc_state, uint64_t& start_time) {
+    std::ifstream file{"/proc/" + std::to_string(pid) + "/stat"};
+    std::string stat{std::istreambuf_iterator<char>(file), std::istreambuf_iterator<char>()};
+    // the command name in parentheses before the other fields might contain spaces
+    size_t pos = stat.rfind(')');
+    if (pos == std::string::npos) { return false; }
+    std::istringstream fields{stat.substr(pos + 1)};
+    // the state is the third field and the start time the 22nd
+    fields >> proc_state;
+    std::string field;
+    for (int idx = 4; idx < 22; ++idx) { fields >> field; }
+    fields >> start_time;
+    return (bool) fields;
+}
+
+// computed on first use, and again in a forked child
+static std::atomic_uint32_t process_owner_token{0};
+#endif
+
+void SpinMutex::after_fork() {
+    // the forking thread would have the same id in both processes otherwise
+    tid = std::random_device{}();
+#ifdef __linux__
+    process_owner_token.store(0);
+#endif
+}
+
+#ifdef __linux__
+bool SpinMutex::fork_handler = []() {
+    pthread_atfork(nullptr, nullptr, &SpinMutex::after_fork);
+    return true;
+}();
+#endif
+
+uint32_t SpinMutex::owner_token() {
+#ifdef __linux__
+    uint32_t token = process_owner_token.load(std::memory_order_relaxed);
+    if (token == 0) {
+        pid_t pid = getpid();
+        char proc_state;
+        uint64_t start_time = 0;
+        read_process_stat(pid, proc_state, start_time);
+        // process ids have at most 22 bits
+        token = ((uint32_t) pid << START_TIME_BITS) |
+                (uint32_t) (start_time & ((1u << START_TIME_BITS) - 1));
+        process_owner_token.store(token, std::memory_order_relaxed);
+    }
+    return token;
+#else
+    return 0;
+#endif
+}
+
+bool SpinMutex::is_owner_dead(uint32_t owner) {
+#ifdef __linux__
+    pid_t pid = (pid_t) (owner >> START_TIME_BITS);
+    if (pid == 0 || owner == owner_token()) { return false; }
+    if (kill(pid, 0) == -1 && errno == ESRCH) { return true; }
+    char proc_state;
+    uint64_t start_time;
+    // the process might not be visible in /proc, then it is assumed to be alive
+    if (!read_process_stat(pid, proc_state, start_time)) { return false; }
+    // a zombie process has exited, but was not reaped yet by its parent
+    if (proc_state == 'Z' || proc_state == 'X') { return true; }
+    // otherwise, the process id might have been reused by another process
+    return (start_time & ((1u << START_TIME_BITS) - 1)) != (owner & ((1u << START_TIME_BITS) - 1));
+#else
+    (void) owner;
+    return false;
+#endif
+}
+
+bool SpinMutex::recover(uint32_t owner) {
+    // only one thread gets to take over the lock
+    if (!write_lock_owner.compare_exchange_strong(owner, owner_token(),
+                                                  std::memory_order_acquire)) {
+        return false;
+    }
+    write_lock_tid = tid;
+    uint64_t s = state.load(std::memory_order_relaxed);
+    uint64_t new_s;
+    do {
+        // the dead owner might have been writing, thus optimistic readers have to retry, too;
+        // its nested write locks are dropped
+        new_s = with_level(s, -1) & ~VERSION_MASK;
+        new_s |= ((s + VERSION_ONE) & VERSION_MASK) | SUSPECT;
+    } while (!state.compare_exchange_weak(s, new_s, std::memory_order_acquire,
+                                          std::memory_order_relaxed));
+    recoveries.fetch_add(1, std::memory_order_relaxed);
+    STST_LOG_WARN() << "took over lock at " << this << " from dead process "
+                    << (owner >> START_TIME_BITS);
+    write_unlock();
+    return true;
+}
+
+namespace {
+
+// a shared segment whose locks the threads of this process record in its journal
+struct JournalSegment {
+    const uint8_t* begin;
+    const uint8_t* end;
+    LockJournal* journal;
+    // the blocks claimed by threads of this process, by their pseudo thread ids
+    std::vector<std::pair<uint32_t, LockJournal::Block*>> blocks;
+};
+
+struct JournalRegistry {
+    std::mutex mutex;
+    std::vector<JournalSegment> segments;
+    // changes whenever a segment is attached or detached, which invalidates cached blocks
+    std::atomic_uint64_t generation{1};
+    // the address range of all attached segments, which skips other locks quickly
+    std::atomic<uintptr_t> min_addr{UINTPTR_MAX};
+    std::atomic<uintptr_t> max_addr{0};
+
+    JournalSegment* find(const void* addr) {
+        for (JournalSegment& segment: segments) {
+            if (addr >= segment.begin && addr < segment.end) { return &segment; }
+        }
+        return nullptr;
+    }
+
+    void update_range() {
+        uintptr_t min = UINTPTR_MAX;
+        uintptr_t max = 0;
+        for (const JournalSegment& segment: segments) {
+            min = std::min(min, (uintptr_t) segment.begin);
+            max = std::max(max, (uintptr_t) segment.end);
+        }
+        min_addr.store(min, std::memory_order_relaxed);
+        max_addr.store(max, std::memory_order_relaxed);
+        generation.fetch_add(1, std::memory_order_release);
+    }
+};
+
+// never destroyed, since StructStoreShared instances with static storage duration might be
+// closed after the static objects of this file are destroyed
+JournalRegistry& journal_registry() {
+    static auto* registry = new JournalRegistry{};
+    return *registry;
+}
+
+// the blocks of the current thread in the segments it locked last; this is trivially
+// constructible, such that it is accessed without initialization guard
+struct JournalCache {
+    static constexpr size_t SIZE = 4;
+
+    struct Segment {
+        const uint8_t* begin;
+        const uint8_t* end;
+        // nullptr if the segment had no unused block
+        LockJournal::Block* block;
+    };
+
+    uint64_t generation;
+    size_t count;
+    Segment segments[SIZE];
+};
+
+thread_local JournalCache journal_cache;
+
+// frees the blocks of the current thread when it exits, unless it still holds locks in them
+struct JournalThreadExit {
+    bool active = false;
+
+    ~JournalThreadExit() {
+        if (!active) { return; }
+        JournalRegistry& registry = journal_registry();
+        std::lock_guard<std::mutex> lock{registry.mutex};
+        uint32_t tid = SpinMutex::get_tid();
+        for (JournalSegment& segment: registry.segments) {
+            auto& blocks = segment.blocks;
+            for (size_t idx = blocks.size(); idx-- > 0;) {
+                if (blocks[idx].first != tid) { continue; }
+                LockJournal::Block& block = *blocks[idx].second;
+                bool empty = std::all_of(std::begin(block.entries), std::end(block.entries),
+                                         [](const LockJournal::Entry& e) { return !e.modes; });
+                if (empty) { block.owner.store(0, std::memory_order_release); }
+                blocks[idx] = blocks.back();
+                blocks.pop_back();
+            }
+        }
+    }
+};
+
+thread_local JournalThreadExit journal_thread_exit;
+
+#ifdef __linux__
+// the child only has the forking thread, whose blocks belong to the parent
+void journal_before_fork() { journal_registry().mutex.lock(); }
+
+void journal_after_fork_parent() { journal_registry().mutex.unlock(); }
+
+void journal_after_fork_child() {
+    JournalRegistry& registry = journal_registry();
+    for (JournalSegment& segment: registry.segments) { segment.blocks.clear(); }
+    registry.generation.fetch_add(1, std::memory_order_relaxed);
+    registry.mutex.unlock();
+}
+
+bool journal_fork_handler = []() {
+    pthread_atfork(&journal_before_fork, &journal_after_fork_parent, &journal_after_fork_child);
+    return true;
+}();
+#endif
+
+} // namespace
+
+LockJournal::LockJournal() {
+    for (Block& block: blocks) {
+        block.owner.store(0, std::memory_order_relaxed);
+        block.tid = 0;
+        for (Entry& entry: block.entries) {
+            entry.lock = nullptr;
+            entry.slots = nullptr;
+            entry.modes = 0;
+        }
+    }
+}
+
+void LockJournal::attach(const void* begin, size_t size) {
+    JournalRegistry& registry = journal_registry();
+    std::lock_guard<std::mutex> lock{registry.mutex};
+    registry.segments.push_back({(const uint8_t*) begin, (const uint8_t*) begin + size, this, {}});
+    registry.update_range();
+}
+
+void LockJournal::detach() {
+    JournalRegistry& registry = journal_registry();
+    std::lock_guard<std::mutex> lock{registry.mutex};
+    for (size_t idx = 0; idx < registry.segments.size(); ++idx) {
+        JournalSegment& segment = registry.segments[idx];
+        if (segment.journal != this) { continue; }
+        for (auto& [tid, block]: segment.blocks) {
+            for (Entry& entry: block->entries) {
+                entry.modes = 0;
+                entry.lock = nullptr;
+            }
+            block->owner.store(0, std::memory_order_release);
+        }
+        registry.segments.erase(registry.segments.begin() + idx);
+        break;
+    }
+    registry.update_range();
+}
+
+LockJournal::Block* LockJournal::find_block(const void* lock) {
+    JournalRegistry& registry = journal_registry();
+    auto addr = (uintptr_t) lock;
+    if (addr < registry.min_addr.load(std::memory_order_relaxed) ||
+        addr >= registry.max_addr.load(std::memory_order_relaxed)) {
+        return nullptr;
+    }
+    JournalCache& cache = journal_cache;
+    uint64_t generation = registry.generation.load(std::memory_order_acquire);
+    if (cache.generation != generation) {
+        cache.generation = generation;
+        cache.count = 0;
+    }
+    for (size_t idx = 0; idx < std::min(cache.count, JournalCache::SIZE); ++idx) {
+        const JournalCache::Segment& segment = cache.segments[idx];
+        if (lock >= segment.begin && lock < segment.end) { return segment.block; }
+    }
+    std::lock_guard<std::mutex> guard{registry.mutex};
+    JournalSegment* segment = registry.find(lock);
+    if (!segment) { return nullptr; }
+    uint32_t tid = SpinMutex::get_tid();
+    LockJournal::Block* block = nullptr;
+    for (auto& [block_tid, claimed]: segment->blocks) {
+        if (block_tid == tid) { block = claimed; }
+    }
+    if (!block) {
+        block = segment->journal->claim_block();
+        if (block) {
+            segment->blocks.emplace_back(tid, block);
+            journal_thread_exit.active = true;
+        }
+    }
+    cache.segments[cache.count++ % JournalCache::SIZE] = {segment->begin, segment->end, block};
+    return block;
+}
+
+LockJournal::Block* LockJournal::claim_block() {
+    uint32_t token = SpinMutex::owner_token();
+    for (Block& block: blocks) {
+        uint32_t owner = 0;
+        if (block.owner.compare_exchange_strong(owner, token, std::memory_order_acquire)) {
+            block.tid = SpinMutex::get_tid();
+            return &block;
+        }
+    }
+    // the blocks of dead processes are reused after releasing their locks
+    for (Block& block: blocks) {
+        uint32_t owner = block.owner.load(std::memory_order_relaxed);
+        if (owner == 0 || !SpinMutex::is_owner_dead(owner)) { continue; }
+        if (block.owner.compare_exchange_strong(owner, token, std::memory_order_acquire)) {
+            release_block(block, owner);
+            block.tid = SpinMutex::get_tid();
+            return &block;
+        }
+    }
+    return nullptr;
+}
+
+size_t LockJournal::release_block(Block& block, uint32_t owner) {
+    size_t released = 0;
+    for (Entry& entry: block.entries) {
+        SpinMutex* lock = entry.lock.get();
+        if (!lock || !entry.modes) { continue; }
+        if (entry.modes & READ) { lock->release(1, SpinMutex::LEVEL_MASK); }
+        if (entry.modes & INTENT_WRITE) {
+            lock->release(SpinMutex::INTENT_WRITE_ONE, SpinMutex::INTENT_WRITE_MASK);
+        }
+        // like intention_unlock, the reader slots are only used once the lock is scalable
+        if ((entry.modes & INTENT_READ) && entry.slots && lock->is_scalable()) {
+            entry.slots->get(block.tid).readers.fetch_sub(1, std::memory_order_release);
+        } else if (entry.modes & INTENT_READ) {
+            lock->release(SpinMutex::INTENT_READ_ONE, SpinMutex::INTENT_READ_MASK);
+        }
+        STST_LOG_WARN() << "released lock at " << lock << " held by dead process "
+                        << (owner >> SpinMutex::START_TIME_BITS);
+        entry.modes = 0;
+        entry.lock = nullptr;
+        ++released;
+    }
+    SpinMutex::recoveries.fetch_add(released, std::memory_order_relaxed);
+    return released;
+}
+
+LockJournal::Entry* LockJournal::record(Entry* entry, SpinMutex& lock, ReaderSlots* slots,
+                                        uint32_t mode) {
+    if (!entry) {
+        Block* block = find_block(&lock);
+        if (!block) { return nullptr; }
+        for (Entry& free_entry: block->entries) {
+            if (!free_entry.modes) {
+                entry = &free_entry;
+                break;
+            }
+        }
+        if (!entry) { return nullptr; }
+        entry->lock = &lock;
+    }
+    if (mode == INTENT_READ) { entry->slots = slots; }
+    // the mode is set last, recovering threads skip entries without one
+    entry->modes |= mode;
+    return entry;
+}
+
+LockJournal::Entry* LockJournal::drop(Entry* entry, uint32_t mode) {
+    if (!entry) { return nullptr; }
+    entry->modes &= ~mode;
+    if (entry->modes) { return entry; }
+    entry->lock = nullptr;
+    return nullptr;
+}
+
+bool LockJournal::is_recorded(const SpinMutex& lock) {
+    JournalRegistry& registry = journal_registry();
+    auto addr = (uintptr_t) &lock;
+    return addr >= registry.min_addr.load(std::memory_order_relaxed) &&
+           addr < registry.max_addr.load(std::memory_order_relaxed);
+}
+
+size_t LockJournal::recover(const SpinMutex& lock) {
+    LockJournal* journal;
+    {
+        JournalRegistry& registry = journal_registry();
+        std::lock_guard<std::mutex> guard{registry.mutex};
+        JournalSegment* segment = registry.find(&lock);
+        if (!segment) { return 0; }
+        journal = segment->journal;
+    }
+    size_t released = 0;
+    uint32_t token = SpinMutex::owner_token();
+    for (Block& block: journal->blocks) {
+        uint32_t owner = block.owner.load(std::memory_order_relaxed);
+        if (owner == 0 || !SpinMutex::is_owner_dead(owner)) { continue; }
+        // only one thread releases the locks of a block
+        if (!block.owner.compare_exchange_strong(owner, token, std::memory_order_acquire)) {
+            continue;
+        }
+        released += release_block(block, owner);
+        block.owner.store(0, std::memory_order_release);
+    }
+    return released;
+}
+
+static inline void cpu_relax() {
+#if defined(__x86_64__) || defined(__i386__)
+    __builtin_ia32_pause();
+#elif defined(__aarch64__)
+    asm volatile("yield");
+#endif
+}
+
+// the timeouts set by StructStoreShared::set_lock_timeout, by root field
+static std::mutex store_timeouts_mutex;
+static std::unordered_map<const FieldTypeBase*, double> store_timeouts;
+static std::atomic_size_t store_timeout_count{0};
+
+void LockDeadline::set_store_timeout(const FieldTypeBase& root, double timeout) {
+    std::lock_guard<std::mutex> lock{store_timeouts_mutex};
+    store_timeouts[&root] = timeout;
+    store_timeout_count.store(store_timeouts.size());
+}
+
+void LockDeadline::reset_store_timeout(const FieldTypeBase& root) {
+    std::lock_guard<std::mutex> lock{store_timeouts_mutex};
+    store_timeouts.erase(&root);
+    store_timeout_count.store(store_timeouts.size());
+}
+
+double LockDeadline::get_store_timeout(const FieldTypeBase& field) {
+    if (store_timeout_count.load(std::memory_order_relaxed) == 0) { return DEFAULT_TIMEOUT; }
+    const FieldTypeBase* root = &field;
+    while (root->parent_field) { root = root->parent_field.get(); }
+    std::lock_guard<std::mutex> lock{store_timeouts_mutex};
+    auto it = store_timeouts.find(root);
+    return it == store_timeouts.end() ? DEFAULT_TIMEOUT : it->second;
+}
+
+bool LockDeadline::check() {
+    clock::time_point now = clock::now();
+    if (!started) {
+        started = true;
+        if (field) { timeout = get_store_timeout(*field); }
+        if (timeout == 0.0) { return false; }
+        if (timeout < 0.0) {
+            deadline = clock::time_point::max();
+        } else {
+            deadline = now + std::chrono::duration_cast<clock::duration>(
+                                     std::chrono::duration<double>(timeout));
+        }
+        return true;
+    }
+    return now <= deadline;
+}
+
+int64_t LockDeadline::remaining_nsecs() const {
+    if (timeout < 0.0) { return -1; }
+    auto nsecs = std::chrono::duration_cast<std::chrono::nanoseconds>(deadline - clock::now());
+    return std::max<int64_t>(nsecs.count(), 0);
+}
+
+// the stats recorded while instrumentation is enabled, by mutex
+struct LockCounters {
+    std::atomic_uint64_t acquisitions{0};
+    std::atomic_uint64_t contended{0};
+    std::atomic_uint64_t timeouts{0};
+    std::atomic_uint64_t spins{0};
+    std::atomic_uint64_t wait_nsecs{0};
+    std::atomic_uint64_t max_hold_nsecs{0};
+    std::atomic_uint32_t max_hold_tid{0};
+};
+
+static std::atomic_bool lock_instrumentation{false};
+// set while the locks of the current thread are not recorded, see SpinMutex::Untracked
+static thread_local bool lock_untracked = false;
+static std::shared_mutex lock_stats_mutex;
+static std::unordered_map<const SpinMutex*, LockCounters> lock_stats;
+
+// the read and write locks held by the current thread while instrumentation is enabled, with
+// the times at which they were acquired; locks beyond the capacity are not recorded
+struct HoldStart {
+    const SpinMutex* mutex;
+    int64_t nsecs;
+};
+
+static constexpr size_t MAX_HOLD_STARTS = 64;
+static thread_local HoldStart hold_starts[MAX_HOLD_STARTS];
+static thread_local size_t hold_start_count = 0;
+
+static inline bool is_tracked() {
+    return lock_instrumentation.load(std::memory_order_relaxed) && !lock_untracked;
+}
+
+static inline int64_t now_nsecs() {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(
+                   std::chrono::steady_clock::now().time_since_epoch())
+            .count();
+}
+
+// calls fn with the counters of the mutex, which are created if needed
+template<typename Fn>
+static void update_lock_stats(const SpinMutex* mutex, Fn&& fn) {
+    {
+        std::shared_lock<std::shared_mutex> lock{lock_stats_mutex};
+        auto it = lock_stats.find(mutex);
+        if (it != lock_stats.end()) {
+            fn(it->second);
+            return;
+        }
+    }
+    std::unique_lock<std::shared_mutex> lock{lock_stats_mutex};
+    fn(lock_stats[mutex]);
+}
+
+void SpinMutex::set_instrumentation(bool enabled) { lock_instrumentation.store(enabled); }
+
+bool SpinMutex::is_instrumented() { return lock_instrumentation.load(); }
+
+SpinMutex::Untracked::Untracked() : prev{lock_untracked} { lock_untracked = true; }
+
+SpinMutex::Untracked::~Untracked() { lock_untracked = prev; }
+
+void SpinMutex::reset_stats() {
+    std::unique_lock<std::shared_mutex> lock{lock_stats_mutex};
+    lock_stats.clear();
+}
+
+bool SpinMutex::get_stats(LockStats& stats) const {
+    std::shared_lock<std::shared_mutex> lock{lock_stats_mutex};
+    auto it = lock_stats.find(this);
+    if (it == lock_stats.end()) { return false; }
+    const LockCounters& counters = it->second;
+    stats.acquisitions = counters.acquisitions.load(std::memory_order_relaxed);
+    stats.contended = counters.contended.load(std::memory_order_relaxed);
+    stats.timeouts = counters.timeouts.load(std::memory_order_relaxed);
+    stats.spins = counters.spins.load(std::memory_order_relaxed);
+    stats.wait_nsecs = counters.wait_nsecs.load(std::memory_order_relaxed);
+    stats.max_hold_nsecs = counters.max_hold_nsecs.load(std::memory_order_relaxed);
+    stats.max_hold_tid = counters.max_hold_tid.load(std::memory_order_relaxed);
+    stats.holder_tid = write_lock_tid;
+    return true;
+}
+
+void SpinMutex::hold_started() const {
+    if (!is_tracked()) { return; }
+    if (hold_start_count == MAX_HOLD_STARTS) { return; }
+    hold_starts[hold_start_count++] = HoldStart{this, now_nsecs()};
+}
+
+void SpinMutex::hold_ended() const {
+    // locks acquired while instrumentation was enabled are still removed after disabling it
+    if (hold_start_count == 0) { return; }
+    for (size_t idx = hold_start_count; idx-- > 0;) {
+        if (hold_starts[idx].mutex != this) { continue; }
+        uint64_t nsecs = now_nsecs() - hold_starts[idx].nsecs;
+        hold_starts[idx] = hold_starts[--hold_start_count];
+        if (!is_tracked()) { return; }
+        update_lock_stats(this, [&](LockCounters& counters) {
+            uint64_t max = counters.max_hold_nsecs.load(std::memory_order_relaxed);
+            while (nsecs > max) {
+                if (counters.max_hold_nsecs.compare_exchange_weak(max, nsecs,
+                                                                  std::memory_order_relaxed)) {
+                    counters.max_hold_tid.store(tid, std::memory_order_relaxed);
+                    break;
+                }
+            }
+        });
+        return;
+    }
+}
+
+void LockStatsCollector::add(const SpinMutex& mutex) {
+    LockStats stats;
+    if (mutex.get_stats(stats)) { entries.emplace_back(path, stats); }
+}
+
+size_t LockStatsCollector::enter(std::string_view name) {
+    size_t length = path.size();
+    if (!path.empty()) { path += '.'; }
+    path += name;
+    return length;
+}
+
+size_t LockStatsCollector::enter(size_t index) {
+    size_t length = path.size();
+    path += '[' + std::to_string(index) + ']';
+    return length;
+}
+
+std::vector<std::pair<std::string, LockStats>> LockStatsCollector::top(size_t count) {
+    std::sort(entries.begin(), entries.end(), [](const auto& a, const auto& b) {
+        if (a.second.wait_nsecs != b.second.wait_nsecs) {
+            return a.second.wait_nsecs > b.second.wait_nsecs;
+        }
+        return a.second.contended > b.second.contended;
+    });
+    if (entries.size() > count) { entries.resize(count); }
+    return std::move(entries);
+}
+
+namespace structstore {
+
+// waits for a change of the state of a SpinMutex: first by spinning with exponential backoff,
+// then by yielding or sleeping, until the deadline has passed
+class LockWaiter {
+    // the last round spins for 1 << MAX_SPIN_ROUND iterations
+    static constexpr uint32_t MAX_SPIN_ROUND = 10;
+    // how often a sleeping thread checks whether the process holding the write lock has died
+    static constexpr int64_t OWNER_CHECK_NSECS = 10'000'000;
+
+    SpinMutex& mutex;
+    LockDeadline& deadline;
+    uint32_t round = 0;
+    int64_t next_owner_check = 0;
+    // when to check the journal for locks of dead processes first, zero until the first wait
+    int64_t next_journal_check = 0;
+    // the free state with a pending writer seen last, and since when
+    uint64_t pending_state = 0;
+    int64_t pending_since = 0;
+    // for the stats, which are only recorded if instrumentation is enabled
+    uint64_t spins = 0;
+    int64_t wait_start = -1;
+
+public:
+    LockWaiter(SpinMutex& mutex, LockDeadline& deadline) : mutex{mutex}, deadline{deadline} {}
+
+    // s is the state which prevented getting the lock; returns false if the deadline passed
+    bool wait(uint64_t s) {
+        start_waiting();
+        if (!deadline.check()) { return false; }
+        if (spin()) { return true; }
+        bool write_locked = SpinMutex::get_level(s) < 0;
+        if (write_locked && recover_from_dead_owner()) { return true; }
+        bool held = !write_locked && (s & SpinMutex::HELD_MASK);
+        if (held && recover_from_journal()) { return true; }
+        // only a writer which is about to take the free lock keeps it waiting
+        bool free_for_writer = (s & SpinMutex::WRITER_PENDING) && !(s & SpinMutex::HELD_MASK);
+        if (free_for_writer && drop_stale_writer(s)) { return true; }
+#ifdef __linux__
+        if (SpinMutex::wait_mode.load(std::memory_order_relaxed) == SpinMutex::FUTEX) {
+            // announce the sleeper, the next release of a count then wakes it
+            if (!(s & SpinMutex::WAITERS) &&
+                !mutex.state.compare_exchange_strong(s, s | SpinMutex::WAITERS,
+                                                     std::memory_order_relaxed)) {
+                return true;
+            }
+            int64_t nsecs = deadline.remaining_nsecs();
+            // nobody wakes this thread if the owner, a recorded holder or the pending writer dies
+            bool check = write_locked || free_for_writer ||
+                         (held && LockJournal::is_recorded(mutex));
+            if (check && (nsecs < 0 || nsecs > OWNER_CHECK_NSECS)) {
+                nsecs = OWNER_CHECK_NSECS;
+            }
+            timespec timeout{(time_t) (nsecs / 1'000'000'000), (long) (nsecs % 1'000'000'000)};
+            // not FUTEX_PRIVATE_FLAG, since the lock might be shared with other processes
+            uint32_t word = (uint32_t) (s | SpinMutex::WAITERS);
+            syscall(SYS_futex, mutex.futex_word(), FUTEX_WAIT, word,
+                    nsecs < 0 ? nullptr : &timeout, nullptr, 0);
+            return true;
+        }
+#endif
+        std::this_thread::yield();
+        return true;
+    }
+
+    // waits for a change which does not wake up sleeping threads, e.g. in the reader slots
+    bool pause() {
+        start_waiting();
+        if (!deadline.check()) { return false; }
+        if (!spin() && !recover_from_journal()) { std::this_thread::yield(); }
+        return true;
+    }
+
+    // records the outcome of the acquisition if instrumentation is enabled, returns acquired
+    bool finish(bool acquired) {
+        if (!is_tracked()) { return acquired; }
+        uint64_t nsecs = wait_start < 0 ? 0 : now_nsecs() - wait_start;
+        update_lock_stats(&mutex, [&](LockCounters& counters) {
+            if (acquired) {
+                counters.acquisitions.fetch_add(1, std::memory_order_relaxed);
+            } else {
+                counters.timeouts.fetch_add(1, std::memory_order_relaxed);
+            }
+            if (wait_start >= 0) {
+                counters.contended.fetch_add(1, std::memory_order_relaxed);
+                counters.spins.fetch_add(spins, std::memory_order_relaxed);
+                counters.wait_nsecs.fetch_add(nsecs, std::memory_order_relaxed);
+            }
+        });
+        return acquired;
+    }
+
+private:
+    // takes over the write lock if the process holding it has died, which is checked once in a
+    // while; returns true if the lock was released thereby
+    bool recover_from_dead_owner() {
+        int64_t now = now_nsecs();
+        if (now < next_owner_check) { return false; }
+        next_owner_check = now + OWNER_CHECK_NSECS;
+        uint32_t owner = mutex.write_lock_owner.load(std::memory_order_relaxed);
+        if (owner == 0 || !SpinMutex::is_owner_dead(owner)) { return false; }
+        // if another thread was faster, the lock was released nevertheless
+        mutex.recover(owner);
+        return true;
+    }
+
+    // releases the read and intention locks of dead processes recorded in the journal, which is
+    // checked once in a while after waiting for a whole interval; returns true if any were
+    // released
+    bool recover_from_journal() {
+        if (!LockJournal::is_recorded(mutex)) { return false; }
+        int64_t now = now_nsecs();
+        if (next_journal_check == 0) { next_journal_check = now + OWNER_CHECK_NSECS; }
+        if (now < next_journal_check) { return false; }
+        next_journal_check = now + OWNER_CHECK_NSECS;
+        return LockJournal::recover(mutex) > 0;
+    }
+
+    // clears WRITER_PENDING if the lock stayed free for the pending writer during a whole check
+    // interval, i.e. the writer died while waiting; returns true if the bit was cleared
+    bool drop_stale_writer(uint64_t s) {
+        int64_t now = now_nsecs();
+        s &= ~SpinMutex::WAITERS;
+        if (s != pending_state) {
+            pending_state = s;
+            pending_since = now;
+            return false;
+        }
+        if (now - pending_since < OWNER_CHECK_NSECS) { return false; }
+        // the version changes as soon as the writer gets the lock
+        uint64_t cur = mutex.state.load(std::memory_order_relaxed);
+        while ((cur & ~SpinMutex::WAITERS) == s) {
+            uint64_t new_s = cur & ~(SpinMutex::WRITER_PENDING | SpinMutex::WAITERS);
+            if (mutex.state.compare_exchange_weak(cur, new_s, std::memory_order_relaxed)) {
+                if (cur & SpinMutex::WAITERS) { mutex.wake_waiters(); }
+                break;
+            }
+        }
+        return true;
+    }
+
+    inline void start_waiting() {
+        if (wait_start < 0 && is_tracked()) {
+            wait_start = now_nsecs();
+        }
+    }
+
+    // returns false once the spinning rounds are exhausted
+    bool spin() {
+        if (round == MAX_SPIN_ROUND) { return false; }
+        for (uint32_t i = 0; i < (1u << round); ++i) { cpu_relax(); }
+        spins += 1u << round;
+        ++round;
+        return true;
+    }
+};
+
+} // namespace structstore
+
+void SpinMutex::wake_waiters() {
+#ifdef __linux__
+    syscall(SYS_futex, futex_word(), FUTEX_WAKE, INT_MAX, nullptr, nullptr, 0);
+#endif
+}
+
+void SpinMutex::set_level(int16_t level) {
+    uint64_t s = state.load(std::memory_order_relaxed);
+    uint64_t new_s;
+    do {
+        new_s = with_level(s, level);
+        if (level == 0) { new_s &= ~WAITERS; }
+    } while (!state.compare_exchange_weak(s, new_s, std::memory_order_release,
+                                          std::memory_order_relaxed));
+    if (level == 0 && (s & WAITERS)) { wake_waiters(); }
+}
+
+bool SpinMutex::try_add(LockDeadline& deadline, uint64_t one, uint64_t blocking, uint64_t own,
+                        bool owned) {
+    LockWaiter waiter{*this, deadline};
+    uint64_t s = state.load(std::memory_order_relaxed);
+    while (true) {
+        if (get_level(s) < 0 || (s & blocking) != own || (!owned && blocked_by_writer(s))) {
+            if (!waiter.wait(s)) { return waiter.finish(false); }
+            s = state.load(std::memory_order_relaxed);
+        } else if (state.compare_exchange_weak(s, s + one, std::memory_order_acquire,
+                                               std::memory_order_relaxed)) {
+            return waiter.finish(true);
+        }
+    }
+}
+
+void SpinMutex::clear_writer_pending() {
+    uint64_t s = state.fetch_and(~(WRITER_PENDING | WAITERS), std::memory_order_relaxed);
+    if (s & WAITERS) { wake_waiters(); }
+}
+
+void SpinMutex::release(uint64_t one, uint64_t mask) {
+    uint64_t s = state.load(std::memory_order_relaxed);
+    uint64_t new_s;
+    // waiters proceed once the count drops to zero, or to one if that is their own share, see
+    // try_add; clearing WAITERS changes the futex word, which the intention counts are not part
+    // of, such that a waiter which is about to sleep does not miss the wakeup
+    bool wake;
+    do {
+        new_s = s - one;
+        wake = (new_s & mask) <= one && (s & WAITERS);
+        if (wake) { new_s &= ~WAITERS; }
+    } while (!state.compare_exchange_weak(s, new_s, std::memory_order_release,
+                                          std::memory_order_relaxed));
+    if (wake) { wake_waiters(); }
+}
+
+bool SpinMutex::try_read_lock(LockDeadline& deadline, bool own_intent_write, bool owned) {
     STST_LOG_DEBUG() << "read locking " << this;
     if (write_lock_tid == tid) {
         throw std::runtime_error("trying to acquire read lock while current thread has write lock");
     }
-    int16_t v;
-    TIMEOUT_CHECK_INIT
-    do {
-        while ((v = level.load(std::memory_order_relaxed)) < 0) { TIMEOUT_CHECK("read lock"); }
-    } while (!level.compare_exchange_weak(v, v + 1, std::memory_order_acquire));
-    STST_LOG_DEBUG() << "read locked at " << this << " at level " << v + 1;
+    // writers below would change the data while reading it
+    if (!try_add(deadline, 1, INTENT_WRITE_MASK, own_intent_write ? INTENT_WRITE_ONE : 0,
+                 owned || own_intent_write)) {
+        return false;
+    }
+    hold_started();
+    STST_LOG_DEBUG() << "read locked at " << this;
+    return true;
+}
+
+void SpinMutex::read_lock() {
+    LockDeadline deadline{LockDeadline::DEFAULT_TIMEOUT};
+    if (!try_read_lock(deadline)) { throw std::runtime_error("timeout while getting read lock"); }
 }
 
 void SpinMutex::read_unlock() {
     STST_LOG_DEBUG() << "read unlocking " << this;
-    int16_t v = level.load(std::memory_order_relaxed);
-    while (!level.compare_exchange_weak(v, v - 1, std::memory_order_acquire));
-    STST_LOG_DEBUG() << "read unlocked at " << this << " at level " << v - 1;
+    hold_ended();
+    release(1, LEVEL_MASK);
 }
 
-void SpinMutex::write_lock() {
+bool SpinMutex::try_write_lock(LockDeadline& deadline, ReaderSlots* slots) {
     STST_LOG_DEBUG() << "write locking " << this;
-    int16_t v;
     if (write_lock_tid == tid) {
-        v = level.load(std::memory_order_relaxed);
-        level.store(v - 1, std::memory_order_relaxed);
-        return;
+        set_level(get_level(state.load(std::memory_order_relaxed)) - 1);
+        return true;
+    }
+    bool prefer = writer_preference.load(std::memory_order_relaxed);
+    // whether this writer set WRITER_PENDING, which it then clears again
+    bool announced = false;
+    LockWaiter waiter{*this, deadline};
+    uint64_t s = state.load(std::memory_order_relaxed);
+    while (true) {
+        if (s & HELD_MASK) {
+            if (!waiter.wait(s)) {
+                if (announced) { clear_writer_pending(); }
+                return waiter.finish(false);
+            }
+            s = state.load(std::memory_order_relaxed);
+            // block new readers once this writer has to wait, also after another writer which
+            // announced itself got the lock
+            if (prefer && (s & HELD_MASK) && !(s & WRITER_PENDING) &&
+                state.compare_exchange_strong(s, s | WRITER_PENDING, std::memory_order_relaxed)) {
+                s |= WRITER_PENDING;
+                announced = true;
+            }
+        } else {
+            // each write lock starts a new version of the data
+            uint64_t new_s = with_level(s, -1) & ~VERSION_MASK;
+            new_s |= (s + VERSION_ONE) & VERSION_MASK;
+            // other waiting writers announce themselves again when they are woken up
+            new_s &= ~WRITER_PENDING;
+            if (state.compare_exchange_weak(s, new_s, std::memory_order_acquire,
+                                            std::memory_order_relaxed)) {
+                break;
+            }
+        }
+    }
+    // optimistic readers have to see the new version before any of the writes
+    std::atomic_thread_fence(std::memory_order_release);
+    if (slots && (s & SCALABLE)) {
+        // new readers back off now, wait for the remaining ones
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        for (ReaderSlots::Slot& slot: slots->slots) {
+            while (slot.readers.load(std::memory_order_acquire) != 0) {
+                if (!waiter.pause()) {
+                    set_level(0);
+                    return waiter.finish(false);
+                }
+            }
+        }
     }
-    TIMEOUT_CHECK_INIT
-    do {
-        while ((v = level.load(std::memory_order_relaxed)) != 0) { TIMEOUT_CHECK("write lock"); }
-    } while (!level.compare_exchange_weak(v, -1, std::memory_order_acquire));
     if (write_lock_tid != 0) { throw std::runtime_error("internal error: write_lock_tid != 0"); }
     write_lock_tid = tid;
+    write_lock_owner.store(owner_token(), std::memory_order_relaxed);
+    hold_started();
     STST_LOG_DEBUG() << "write locked at " << this;
+    return waiter.finish(true);
+}
+
+void SpinMutex::write_lock() {
+    LockDeadline deadline{LockDeadline::DEFAULT_TIMEOUT};
+    if (!try_write_lock(deadline)) { throw std::runtime_error("timeout while getting write lock"); }
 }
 
 void SpinMutex::write_unlock() {
-    int16_t v = level.load(std::memory_order_relaxed);
-    level.store(v + 1, std::memory_order_release);
-    if (v + 1 == 0) { write_lock_tid = 0; }
+    int16_t v = get_level(state.load(std::memory_order_relaxed));
+    // clear the owner before releasing the lock, otherwise the next writer may see a stale tid
+    if (v + 1 == 0) {
+        hold_ended();
+        write_lock_owner.store(0, std::memory_order_relaxed);
+        write_lock_tid = 0;
+    }
+    set_level(v + 1);
     STST_LOG_DEBUG() << "write unlocked " << this;
 }
 
-void SpinMutex::read_or_write_lock() {
+bool SpinMutex::try_intention_lock(bool write, LockDeadline& deadline, ReaderSlots* slots,
+                                   bool own_read, bool owned) {
+    uint64_t one = write ? INTENT_WRITE_ONE : INTENT_READ_ONE;
     if (write_lock_tid == tid) {
-        write_lock();
-    } else {
-        read_lock();
+        // the write lock of this thread covers the whole field
+        if (!write && slots && is_scalable()) {
+            slots->get(tid).readers.fetch_add(1, std::memory_order_relaxed);
+        } else {
+            state.fetch_add(one, std::memory_order_relaxed);
+        }
+        return true;
+    }
+    if (write) { return try_add(deadline, one, LEVEL_MASK, own_read ? 1 : 0, owned || own_read); }
+    if (!slots || !is_scalable()) { return try_add(deadline, one, 0, 0, owned); }
+    LockWaiter waiter{*this, deadline};
+    std::atomic_int32_t& readers = slots->get(tid).readers;
+    while (true) {
+        // announce the reader before checking for a writer, which takes the lock before
+        // checking for readers; thus, at least one of them backs off
+        readers.fetch_add(1, std::memory_order_seq_cst);
+        uint64_t s = state.load(std::memory_order_seq_cst);
+        if (get_level(s) >= 0 && (owned || !blocked_by_writer(s))) {
+            return waiter.finish(true);
+        }
+        readers.fetch_sub(1, std::memory_order_relaxed);
+        if (!waiter.wait(s)) { return waiter.finish(false); }
     }
 }
 
-void SpinMutex::read_or_write_unlock() {
-    if (write_lock_tid == tid) {
-        write_unlock();
+void SpinMutex::intention_unlock(bool write, ReaderSlots* slots) {
+    if (write) {
+        release(INTENT_WRITE_ONE, INTENT_WRITE_MASK);
+    } else if (slots && is_scalable()) {
+        slots->get(tid).readers.fetch_sub(1, std::memory_order_release);
     } else {
-        read_unlock();
+        release(INTENT_READ_ONE, INTENT_READ_MASK);
     }
 }
 
@@ -130,6 +1016,14 @@ ScopedFieldLock<true>::ScopedFieldLock(const FieldTypeBase& field) : field(&fiel
     field.write_lock_();
 }
 
+template<>
+ScopedFieldLock<false>::ScopedFieldLock(const FieldTypeBase& field, LockDeadline& deadline)
+    : field(field.try_read_lock_(deadline) ? &field : nullptr) {}
+
+template<>
+ScopedFieldLock<true>::ScopedFieldLock(const FieldTypeBase& field, LockDeadline& deadline)
+    : field(field.try_write_lock_(deadline) ? &field : nullptr) {}
+
 template<>
 void ScopedFieldLock<false>::unlock() {
     if (field) {
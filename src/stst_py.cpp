@@ -144,6 +144,7 @@ __attribute__((__visibility__("default"))) void py::set_field(FieldMap<true>& fi
                                                               const nb::handle& value,
                                                               const FieldTypeBase& parent_field) {
     STST_LOG_DEBUG() << "setting field to type " << nb::repr(value.type()).c_str();
-    auto access = FieldAccess<true>{field_map[name], field_map.get_alloc(), &parent_field};
+    auto access = FieldAccess<true>{field_map[name], field_map.get_alloc(), &parent_field,
+                                    &field_map};
     from_python(access, value, name);
 }
@@ -3,19 +3,71 @@
 #include "structstore/stst_callstack.hpp"
 #include "structstore/stst_structstore.hpp"
 
+#include <algorithm>
+
+#include <linux/magic.h>
+#include <sys/statfs.h>
+
 // todo: provide a .to_local() method to get a StructStore copy using static_alloc
 
 using namespace structstore;
 
-StructStoreShared::SharedData::SharedData(size_t size, size_t bufsize, void* buffer)
-    : size{size}, usage_count{1}, sh_alloc{buffer, bufsize}, invalidated{false} {
+// returns the page size of the file system of the given file, which is the huge page size
+// for files on hugetlbfs
+static size_t get_page_size(int fd) {
+    size_t page_size = sysconf(_SC_PAGESIZE);
+    struct statfs fs_state = {};
+    if (fstatfs(fd, &fs_state) == 0 && fs_state.f_type == HUGETLBFS_MAGIC) {
+        page_size = fs_state.f_bsize;
+    }
+    return page_size;
+}
+
+static size_t round_to_pages(size_t size, size_t page_size) {
+    return (size + page_size - 1) / page_size * page_size;
+}
+
+// transparent huge pages have to be advised before the pages are touched
+static bool needs_thp_advice(int fd, int map_options) {
+    return (map_options & HUGE_PAGES) && get_page_size(fd) == (size_t) sysconf(_SC_PAGESIZE);
+}
+
+static int get_map_flags(int fd, int map_options) {
+    int flags = MAP_SHARED;
+    if ((map_options & PREFAULT) && !needs_thp_advice(fd, map_options)) {
+        flags |= MAP_POPULATE;
+    }
+    return flags;
+}
+
+// prefaults or locks the given range of a mapped segment, depending on map_options
+static bool prepare_pages(void* addr, size_t length, int map_options) {
+    if (map_options & LOCK_MEMORY) { return mlock(addr, length) == 0; }
+#ifdef MADV_POPULATE_WRITE
+    if (map_options & PREFAULT) { madvise(addr, length, MADV_POPULATE_WRITE); }
+#endif
+    return true;
+}
+
+StructStoreShared::SharedData::SharedData(size_t size, size_t max_size, size_t bufsize,
+                                          void* buffer, AllocMode alloc_mode)
+    : size{size}, max_size{max_size}, usage_count{1}, sh_alloc{buffer, bufsize, alloc_mode},
+      invalidated{false} {
     store = sh_alloc.allocate<StructStore>();
     new (store.get()) StructStore(sh_alloc);
 }
 
 StructStoreShared::StructStoreShared(const std::string& path, size_t bufsize, bool reinit,
-                                     bool use_file, CleanupMode cleanup)
-    : path(path), fd{-1}, sh_data_ptr{nullptr}, use_file{use_file}, cleanup{cleanup} {
+                                     bool use_file, CleanupMode cleanup, size_t max_bufsize,
+                                     int map_options, AllocMode alloc_mode)
+    : path(path), fd{-1}, sh_data_ptr{nullptr}, use_file{use_file}, cleanup{cleanup},
+      map_options{0} {
+
+    if (max_bufsize < bufsize) {
+        max_bufsize = bufsize;
+    } else if (max_bufsize > bufsize && bufsize % 8 != 0) {
+        throw std::runtime_error("size of growable shared memory has to be a multiple of 8");
+    }
 
     if (use_file) {
         fd = FD(open(path.c_str(), O_EXCL | O_CREAT | O_RDWR, 0600));
@@ -50,7 +102,9 @@ StructStoreShared::StructStoreShared(const std::string& path, size_t bufsize, bo
         sh_data_ptr->usage_count -= 1;
 
         // ... then unmap it, ...
-        munmap(sh_data_ptr, sh_data_ptr->size);
+        sh_data_ptr->sh_alloc.release_thread_caches();
+        sh_data_ptr->sh_alloc.set_grow_fn({});
+        munmap(sh_data_ptr, sh_data_ptr->max_size);
         sh_data_ptr = nullptr;
 
         // ... then unlink it, ...
@@ -78,7 +132,19 @@ StructStoreShared::StructStoreShared(const std::string& path, size_t bufsize, bo
         throw std::runtime_error("shared memory not initialized");
     }
 
+    // set only now, since an old segment is mapped above just to invalidate it
+    this->map_options = map_options;
+
     size_t size = sizeof(SharedData) + bufsize;
+    // growth happens in steps of 8 bytes
+    size_t max_size = sizeof(SharedData) + max_bufsize - (max_bufsize - bufsize) % 8;
+    size_t page_size = get_page_size(fd.get());
+    if (page_size > (size_t) sysconf(_SC_PAGESIZE)) {
+        // files on hugetlbfs can only be resized in multiples of the huge page size
+        size = round_to_pages(size, page_size);
+        max_size = round_to_pages(max_size, page_size);
+        bufsize = size - sizeof(SharedData);
+    }
 
     if (created || reinit) {
 
@@ -89,18 +155,22 @@ StructStoreShared::StructStoreShared(const std::string& path, size_t bufsize, bo
             throw std::runtime_error("reserving shared memory failed");
         }
 
-        // share memory
+        // share memory; the whole range up to max_size is mapped, such that other
+        // processes can access grown memory without remapping
 
-        sh_data_ptr =
-                (SharedData*) mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd.get(), 0);
+        sh_data_ptr = (SharedData*) mmap(nullptr, max_size, PROT_READ | PROT_WRITE,
+                                         get_map_flags(fd.get(), map_options), fd.get(), 0);
 
         if (sh_data_ptr == MAP_FAILED) { throw std::runtime_error("mmap'ing new memory failed"); }
+        apply_map_options(fd.get(), size, max_size);
 
         // initialize data
 
+        // the segment was truncated from size zero and is thus zero-filled already;
+        // not touching all pages keeps big file-backed segments sparse
         static_assert((sizeof(SharedData) % 8) == 0);
-        std::memset(sh_data_ptr, 0, size);
-        new(sh_data_ptr) SharedData(size, bufsize, (char*) sh_data_ptr + sizeof(SharedData));
+        new(sh_data_ptr) SharedData(size, max_size, bufsize, (char*) sh_data_ptr + sizeof(SharedData),
+                                    alloc_mode);
         STST_LOG_DEBUG() << "created shared StructStore at " << sh_data_ptr;
 
         // marks the store as ready to be used
@@ -110,14 +180,18 @@ StructStoreShared::StructStoreShared(const std::string& path, size_t bufsize, bo
         mmap_existing_fd();
         STST_LOG_DEBUG() << "opened shared StructStore at " << sh_data_ptr;
     }
+
+    enable_growth();
+    sh_data_ptr->journal.attach(sh_data_ptr, sh_data_ptr->max_size);
 }
 
-StructStoreShared::StructStoreShared(int fd, bool init)
+StructStoreShared::StructStoreShared(int fd, bool init, int map_options)
         : path{},
           fd{-1},
           sh_data_ptr{nullptr},
           use_file{false},
-          cleanup{NEVER} {
+          cleanup{NEVER},
+          map_options{map_options} {
 
     struct stat fd_state = {};
     fstat(fd, &fd_state);
@@ -131,40 +205,46 @@ StructStoreShared::StructStoreShared(int fd, bool init)
 
     if (init) {
         // map new memory
-        sh_data_ptr = (SharedData*) mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+        sh_data_ptr = (SharedData*) mmap(nullptr, size, PROT_READ | PROT_WRITE,
+                                         get_map_flags(fd, map_options), fd, 0);
 
         if (sh_data_ptr == MAP_FAILED) { throw std::runtime_error("mmap'ing new memory failed"); }
+        apply_map_options(fd, size, size);
 
         // initialize data
         static_assert((sizeof(SharedData) % 8) == 0);
         std::memset(sh_data_ptr, 0, size);
-        new(sh_data_ptr) SharedData(size, bufsize, (char*) sh_data_ptr + sizeof(SharedData));
+        new(sh_data_ptr) SharedData(size, size, bufsize, (char*) sh_data_ptr + sizeof(SharedData),
+                                    MINI_MALLOC);
     } else {
         this->fd = FD(fd);
         mmap_existing_fd();
         this->fd.release();
     }
+    sh_data_ptr->journal.attach(sh_data_ptr, sh_data_ptr->max_size);
 }
 
 
 void StructStoreShared::mmap_existing_fd() {
 
-    size_t size;
-    ssize_t result = read(fd.get(), &size, sizeof(size_t));
+    // reads the size and max_size members of SharedData
+    size_t sizes[2];
+    ssize_t result = read(fd.get(), sizes, sizeof(sizes));
 
-    if (result != sizeof(size_t)) {
+    if (result != sizeof(sizes)) {
         throw std::runtime_error("reading original size failed");
     }
 
-    if (size < sizeof(SharedData)) {
+    if (sizes[0] < sizeof(SharedData) || sizes[1] < sizes[0]) {
         throw std::runtime_error("original size is invalid");
     }
 
     lseek(fd.get(), 0, SEEK_SET);
-    sh_data_ptr =
-            (SharedData*) mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd.get(), 0);
+    sh_data_ptr = (SharedData*) mmap(nullptr, sizes[1], PROT_READ | PROT_WRITE,
+                                     get_map_flags(fd.get(), map_options), fd.get(), 0);
 
     if (sh_data_ptr == MAP_FAILED) { throw std::runtime_error("mmap'ing existing memory failed"); }
+    apply_map_options(fd.get(), sizes[0], sizes[1]);
 
     ++sh_data_ptr->usage_count;
 
@@ -173,6 +253,57 @@ void StructStoreShared::mmap_existing_fd() {
 #endif
 }
 
+void StructStoreShared::apply_map_options(int fd_num, size_t size, size_t max_size) {
+    if (needs_thp_advice(fd_num, map_options)) {
+        if (madvise(sh_data_ptr, max_size, MADV_HUGEPAGE) != 0) {
+            STST_LOG_WARN() << "transparent huge pages are not available for shared memory";
+        }
+    }
+    if (!prepare_pages(sh_data_ptr, size, map_options)) {
+        munmap(sh_data_ptr, max_size);
+        sh_data_ptr = nullptr;
+        throw std::runtime_error("locking shared memory failed");
+    }
+}
+
+void StructStoreShared::enable_growth() {
+    if (sh_data_ptr->size == sh_data_ptr->max_size) { return; }
+    int fd_num = fd.get();
+    SharedData* data = sh_data_ptr;
+    size_t page_size = get_page_size(fd_num);
+    int options = map_options;
+    // this is only called while the arena is write-locked, thus one process at a time grows it
+    sh_data_ptr->sh_alloc.set_grow_fn([=](size_t blocksize, size_t size) -> size_t {
+        size_t old_size = sizeof(SharedData) + blocksize;
+        if (old_size >= data->max_size) { return 0; }
+        // at least double the segment, also leaving space for the node headers
+        size_t new_size = std::max(2 * old_size, old_size + size + 64);
+        new_size = round_to_pages(new_size, page_size);
+        new_size = std::min(new_size, data->max_size);
+        if (ftruncate(fd_num, new_size) < 0) { return 0; }
+        // other processes fault in the grown pages on first access
+        size_t start = old_size / page_size * page_size;
+        if (!prepare_pages((char*) data + start, new_size - start, options)) {
+            STST_LOG_WARN() << "locking grown shared memory failed";
+        }
+        STST_LOG_DEBUG() << "grew shared StructStore at " << data << " to " << new_size;
+        data->size = new_size;
+        return new_size - sizeof(SharedData);
+    });
+}
+
+int StructStoreShared::create_memfd(const std::string& name, size_t bufsize, int map_options) {
+    FD memfd{memfd_create(name.c_str(), (map_options & HUGE_PAGES) ? MFD_HUGETLB : 0)};
+    if (memfd.get() == -1) { throw std::runtime_error("creating memory file failed"); }
+    size_t size = round_to_pages(sizeof(SharedData) + bufsize, get_page_size(memfd.get()));
+    if (ftruncate(memfd.get(), size) < 0) {
+        throw std::runtime_error("reserving shared memory failed");
+    }
+    int fd_num = memfd.get();
+    memfd.release();
+    return fd_num;
+}
+
 bool StructStoreShared::revalidate(bool block) {
 
     if (valid()) {
@@ -204,13 +335,20 @@ bool StructStoreShared::revalidate(bool block) {
             // unmap as late as possible; in the non-blocking case
             // this keeps the previously mapped memory accessible
 
-            munmap(sh_data_ptr, sh_data_ptr->size);
+            sh_data_ptr->sh_alloc.release_thread_caches();
+            sh_data_ptr->sh_alloc.set_grow_fn({});
+            register_lock_timeout(false);
+            sh_data_ptr->journal.detach();
+            munmap(sh_data_ptr, sh_data_ptr->max_size);
             sh_data_ptr = nullptr;
 
             // open new segment
 
             fd = std::move(new_fd);
             mmap_existing_fd();
+            enable_growth();
+            sh_data_ptr->journal.attach(sh_data_ptr, sh_data_ptr->max_size);
+            register_lock_timeout(true);
 
             return true;
         }
@@ -231,6 +369,11 @@ void StructStoreShared::close() {
         return;
     }
 
+    sh_data_ptr->sh_alloc.release_thread_caches();
+    sh_data_ptr->sh_alloc.set_grow_fn({});
+    register_lock_timeout(false);
+    sh_data_ptr->journal.detach();
+
     if (((--sh_data_ptr->usage_count == 0 && cleanup == IF_LAST) || cleanup == ALWAYS)) {
         bool expected = false;
         // if cleanup == ALWAYS this ensure that unlink is done exactly once
@@ -246,10 +389,90 @@ void StructStoreShared::close() {
         }
     }
 
-    munmap(sh_data_ptr, sh_data_ptr->size);
+    munmap(sh_data_ptr, sh_data_ptr->max_size);
     sh_data_ptr = nullptr;
 }
 
+void StructStoreShared::reset() {
+    assert_valid();
+    SharedAlloc& sh_alloc = sh_data_ptr->sh_alloc;
+    register_lock_timeout(false);
+    sh_alloc.reset();
+    enable_growth();
+    sh_data_ptr->store = sh_alloc.allocate<StructStore>();
+    new (sh_data_ptr->store.get()) StructStore(sh_alloc);
+    register_lock_timeout(true);
+}
+
+void StructStoreShared::register_lock_timeout(bool active) {
+    if (lock_timeout == LockDeadline::DEFAULT_TIMEOUT) { return; }
+    if (active) {
+        LockDeadline::set_store_timeout(*sh_data_ptr->store, lock_timeout);
+    } else {
+        LockDeadline::reset_store_timeout(*sh_data_ptr->store);
+    }
+}
+
+void StructStoreShared::set_lock_timeout(double timeout) {
+    assert_valid();
+    register_lock_timeout(false);
+    lock_timeout = timeout;
+    register_lock_timeout(true);
+}
+
+std::vector<std::pair<std::string, LockStats>>
+StructStoreShared::contended_locks(size_t count) const {
+    assert_valid();
+    const SharedAlloc& sh_alloc = sh_data_ptr->sh_alloc;
+    LockStatsCollector collector;
+    {
+        // writers below the root hold intention locks on it, which exclude a read lock of the
+        // whole store; rather than waiting for them, only the root is reported then
+        SpinMutex::Untracked untracked;
+        if (auto lock = sh_data_ptr->store->try_read_lock(0.0)) {
+            sh_data_ptr->store->collect_lock_stats(collector);
+        } else {
+            collector.add(sh_data_ptr->store->mutex);
+        }
+    }
+    size_t length = collector.enter("<alloc>");
+    collector.add(sh_alloc.get_mutex());
+    collector.leave(length);
+    length = collector.enter("<strings>");
+    collector.add(sh_alloc.strings().get_mutex());
+    collector.leave(length);
+    return collector.top(count);
+}
+
+size_t StructStoreShared::reclaim_names() {
+    assert_valid();
+    auto lock = sh_data_ptr->store->write_lock();
+    return sh_data_ptr->store->reclaim_names() + sh_data_ptr->sh_alloc.strings().reclaim();
+}
+
+void StructStoreShared::compact() {
+    compaction_block = 0;
+    compact_step(std::numeric_limits<double>::infinity());
+}
+
+bool StructStoreShared::compact_step(double max_pause) {
+    assert_valid();
+    StructStore& store = *sh_data_ptr->store;
+    auto lock = store.write_lock();
+    // cached blocks are merged with their neighbors, so that blocks can be moved there
+    sh_data_ptr->sh_alloc.flush_thread_caches();
+    if (compaction_block == 0) {
+        store.reclaim_names();
+        sh_data_ptr->sh_alloc.strings().reclaim();
+    }
+    Compaction compaction{sh_data_ptr, max_pause, compaction_block};
+    compaction.run([&](Compaction& c) { store.compact(c); });
+    compaction_block = compaction.get_next_block();
+    STST_LOG_DEBUG() << "compaction step at " << sh_data_ptr << " stopped at offset "
+                     << compaction_block;
+    return compaction_block == 0;
+}
+
 void StructStoreShared::to_buffer(void* buffer, size_t bufsize) const {
     assert_valid();
     if (bufsize < sh_data_ptr->size) {
@@ -260,10 +483,20 @@ void StructStoreShared::to_buffer(void* buffer, size_t bufsize) const {
 
 void StructStoreShared::from_buffer(void* buffer, size_t bufsize) {
     assert_valid();
-    if (bufsize < ((SharedData*) buffer)->size) {
+    size_t size = ((SharedData*) buffer)->size;
+    if (bufsize < size) {
         throw std::runtime_error("source buffer too small");
     }
-    std::memcpy(sh_data_ptr, buffer, ((SharedData*) buffer)->size);
+    size_t max_size = sh_data_ptr->max_size;
+    if (size > max_size) {
+        throw std::runtime_error("source buffer larger than shared memory");
+    }
+    if (size > sh_data_ptr->size && ftruncate(fd.get(), size) < 0) {
+        throw std::runtime_error("growing shared memory failed");
+    }
+    std::memcpy(sh_data_ptr, buffer, size);
+    // the mapping of this process is unchanged
+    sh_data_ptr->max_size = max_size;
 }
 
 bool StructStoreShared::operator==(const StructStoreShared& other) const {
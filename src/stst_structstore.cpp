@@ -8,13 +8,90 @@ const TypeInfo& StructStore::type_info =
 
 void StructStore::check(const SharedAlloc* sh_alloc) const {
     CallstackEntry entry{"structstore::StructStore::check()"};
+    if (reader_slots && sh_alloc) { stst_assert(sh_alloc->is_owned(reader_slots.get())); }
+    if (parent_alloc) {
+        // the fields are checked against the sub-arena, which resides in our arena
+        if (sh_alloc) { stst_assert(parent_alloc.get() == sh_alloc); }
+        stst_assert(parent_alloc->is_owned(&field_map.get_alloc()));
+        sh_alloc = nullptr;
+    }
     field_map.check(sh_alloc, *this);
 }
 
+void StructStore::make_sub_arena(size_t bufsize, AllocMode mode) {
+    if (!empty()) { throw std::runtime_error("sub-arena can only be created for empty store"); }
+    // an existing sub-arena is replaced, it is empty anyway
+    if (parent_alloc) { release_sub_arena(); }
+    SharedAlloc& sh_alloc = get_alloc();
+    bufsize -= bufsize % 8;
+    size_t alloc_size = sizeof(SharedAlloc) + (8 - sizeof(SharedAlloc) % 8) % 8;
+    auto* sub_alloc = (SharedAlloc*) sh_alloc.allocate(alloc_size + bufsize);
+    new (sub_alloc) SharedAlloc((uint8_t*) sub_alloc + alloc_size, bufsize, mode);
+    uint64_t generation = field_map.get_generation();
+    field_map.~FieldMap();
+    new (&field_map) FieldMap<true>(*sub_alloc, generation + 1);
+    parent_alloc = &sh_alloc;
+    STST_LOG_DEBUG() << "created sub-arena at " << sub_alloc << " for StructStore at " << this;
+}
+
+void StructStore::release_sub_arena() {
+    SharedAlloc& sub_alloc = get_alloc();
+    uint64_t generation = field_map.get_generation();
+    sub_alloc.discard();
+    // the fields are dropped together with the arena
+    new (&field_map) FieldMap<true>(*parent_alloc, generation + 1);
+    parent_alloc->deallocate(&sub_alloc);
+    parent_alloc = nullptr;
+}
+
+void StructStore::make_read_scalable() {
+    if (reader_slots) { return; }
+    // the slots outlive a sub-arena, which is reset when clearing this store
+    SharedAlloc& sh_alloc = parent_alloc ? *parent_alloc : get_alloc();
+    // each slot has its own cache line only if the slots start at one
+    auto* slots = sh_alloc.allocate_aligned<ReaderSlots>(sizeof(ReaderSlots),
+                                                         SharedAlloc::CACHE_LINE_ALIGN);
+    new (slots) ReaderSlots();
+    reader_slots = slots;
+    auto lock = write_lock();
+    mutex.make_scalable();
+    STST_LOG_DEBUG() << "created reader slots at " << slots << " for StructStore at " << this;
+}
+
+void StructStore::release_reader_slots() {
+    mutex.reset_scalable();
+    SharedAlloc& sh_alloc = parent_alloc ? *parent_alloc : get_alloc();
+    sh_alloc.deallocate(reader_slots.get());
+    reader_slots = nullptr;
+}
+
+ReaderSlots* FieldTypeBase::get_store_reader_slots() const {
+    return static_cast<const StructStore*>(this)->reader_slots.get();
+}
+
+void StructStore::clear() {
+    if (!parent_alloc) {
+        field_map.clear();
+        return;
+    }
+    SharedAlloc& sub_alloc = get_alloc();
+    uint64_t generation = field_map.get_generation();
+    sub_alloc.reset();
+    new (&field_map) FieldMap<true>(sub_alloc, generation + 1);
+}
+
 FieldAccess<true> StructStore::at(const std::string& name) {
-    return FieldAccess<true>{field_map.at(name), field_map.get_alloc(), this};
+    return FieldAccess<true>{field_map.at(name), field_map.get_alloc(), this, &field_map};
 }
 
 FieldAccess<true> StructStore::operator[](const std::string& name) {
-    return FieldAccess<true>{field_map[name], field_map.get_alloc(), this};
+    return FieldAccess<true>{field_map[name], field_map.get_alloc(), this, &field_map};
+}
+
+FieldAccess<true> StructStore::at(const FieldKey& key) {
+    return FieldAccess<true>{field_map.at(key), field_map.get_alloc(), this, &field_map};
+}
+
+FieldAccess<true> StructStore::operator[](const FieldKey& key) {
+    return FieldAccess<true>{field_map[key], field_map.get_alloc(), this, &field_map};
 }
@@ -1,35 +1,249 @@
 #include "structstore/stst_typing.hpp"
 
+#include <algorithm>
+
 using namespace structstore;
 
-void FieldTypeBase::read_lock_() const {
-    if (parent_field) { parent_field->read_or_write_lock_(); }
-    mutex.read_lock();
+namespace {
+
+// a lock of a field which the current thread holds, with the number of times it is held in
+// each mode; a mode is only acquired in shared memory the first time, and not at all if a lock
+// of a parent in the same mode covers it
+struct HeldLock {
+    const FieldTypeBase* field;
+    uint32_t read;
+    uint32_t write;
+    uint32_t intent_read;
+    uint32_t intent_write;
+    // the parents covering the read or write lock, which are held until this one is released
+    const FieldTypeBase* read_cover;
+    const FieldTypeBase* write_cover;
+    // the entry recording the read and intention locks in shared memory, if any
+    LockJournal::Entry* journal;
+
+    // whether the lock is held in shared memory in some mode, such that pending writers wait
+    // for this thread
+    inline bool owned() const {
+        return (read && !read_cover) || (write && !write_cover) || intent_read || intent_write;
+    }
+};
+
+// the locks of fields which the current thread holds; this is trivially constructible, such
+// that it is accessed without initialization guard. the entries move when the table grows,
+// thus references to them are only valid until the next call of get
+struct HeldLocks {
+    // locks held beyond this number are kept in an array on the heap
+    static constexpr size_t INLINE_CAPACITY = 64;
+
+    HeldLock inline_locks[INLINE_CAPACITY];
+    // inline_locks or the heap array, nullptr before the first lock
+    HeldLock* locks;
+    size_t size;
+    size_t capacity;
+
+    HeldLock* find(const FieldTypeBase* field) {
+        // the most recent locks are the most likely to be looked up
+        for (size_t idx = size; idx-- > 0;) {
+            if (locks[idx].field == field) { return &locks[idx]; }
+        }
+        return nullptr;
+    }
+
+    HeldLock& get(const FieldTypeBase* field) {
+        if (HeldLock* held = find(field)) { return *held; }
+        if (size == capacity) { grow(); }
+        locks[size] = HeldLock{field, 0, 0, 0, 0, nullptr, nullptr, nullptr};
+        return locks[size++];
+    }
+
+    void grow() {
+        if (!locks) {
+            locks = inline_locks;
+            capacity = INLINE_CAPACITY;
+            return;
+        }
+        auto* new_locks = new HeldLock[2 * capacity];
+        std::copy(locks, locks + size, new_locks);
+        if (locks != inline_locks) { delete[] locks; }
+        locks = new_locks;
+        capacity *= 2;
+    }
+
+    // removes the lock if it is not held anymore, which moves another one into its place
+    void drop(HeldLock& held) {
+        if (held.read || held.write || held.intent_read || held.intent_write) { return; }
+        held = locks[--size];
+        // the heap array is only kept while this thread holds locks, which it usually does
+        // not when it exits
+        if (size == 0 && locks != inline_locks) {
+            delete[] locks;
+            locks = inline_locks;
+            capacity = INLINE_CAPACITY;
+        }
+    }
+};
+
+thread_local HeldLocks held_locks;
+
+} // namespace
+
+bool FieldTypeBase::try_lock_(bool write, LockDeadline& deadline) const {
+    HeldLock* held = &held_locks.get(this);
+    uint32_t* count = write ? &held->write : &held->read;
+    if (*count > 0) {
+        ++*count;
+        return true;
+    }
+    if (!write && held->write) {
+        throw std::runtime_error("trying to acquire read lock while current thread has write lock");
+    }
+    if (held_locks.size > 1) {
+        if (const FieldTypeBase* cover = find_cover_(write)) {
+            HeldLock& cover_held = held_locks.get(cover);
+            ++(write ? cover_held.write : cover_held.read);
+            (write ? held->write_cover : held->read_cover) = cover;
+            ++*count;
+            return true;
+        }
+    }
+    bool own_intent_write = held->intent_write > 0;
+    bool owned = held->owned();
+    bool parents_locked;
+    try {
+        parents_locked = try_lock_parents_(write, deadline);
+    } catch (...) {
+        held_locks.drop(held_locks.get(this));
+        throw;
+    }
+    if (!parents_locked) {
+        held_locks.drop(held_locks.get(this));
+        return false;
+    }
+    bool locked = write ? mutex.try_write_lock(deadline, get_reader_slots())
+                        : mutex.try_read_lock(deadline, own_intent_write, owned);
+    if (!locked) {
+        unlock_parents_(write);
+        held_locks.drop(held_locks.get(this));
+        return false;
+    }
+    // the table might have grown while locking the parents
+    held = &held_locks.get(this);
+    ++(write ? held->write : held->read);
+    // write locks record their owner in the lock itself
+    if (!write) {
+        held->journal = LockJournal::record(held->journal, mutex, nullptr, LockJournal::READ);
+    }
+    return true;
 }
 
-void FieldTypeBase::read_unlock_() const {
-    mutex.read_unlock();
-    if (parent_field) { parent_field->read_or_write_unlock_(); }
+void FieldTypeBase::unlock_(bool write) const {
+    HeldLock& held = held_locks.get(this);
+    uint32_t& count = write ? held.write : held.read;
+    if (count == 0) { throw std::runtime_error("internal error: field is not locked"); }
+    if (--count > 0) { return; }
+    const FieldTypeBase*& cover = write ? held.write_cover : held.read_cover;
+    if (cover) {
+        const FieldTypeBase* cover_field = cover;
+        cover = nullptr;
+        held_locks.drop(held);
+        cover_field->unlock_(write);
+        return;
+    }
+    if (!write) { held.journal = LockJournal::drop(held.journal, LockJournal::READ); }
+    held_locks.drop(held);
+    if (write) {
+        mutex.write_unlock();
+    } else {
+        mutex.read_unlock();
+    }
+    unlock_parents_(write);
 }
 
-void FieldTypeBase::write_lock_() const {
-    if (parent_field) { parent_field->read_or_write_lock_(); }
-    mutex.write_lock();
+const FieldTypeBase* FieldTypeBase::find_cover_(bool write) const {
+    for (const FieldTypeBase* field = parent_field.get(); field;
+         field = field->parent_field.get()) {
+        HeldLock* held = held_locks.find(field);
+        if (held && (write ? held->write : held->read)) { return field; }
+    }
+    return nullptr;
+}
+
+bool FieldTypeBase::try_lock_parents_(bool write, LockDeadline& deadline) const {
+    HeldLocks& locks = held_locks;
+    for (const FieldTypeBase* field = parent_field.get(); field;
+         field = field->parent_field.get()) {
+        HeldLock* entry;
+        try {
+            entry = &locks.get(field);
+        } catch (...) {
+            // the table could not grow, the parents below are locked already
+            unlock_parents_(write, field);
+            throw;
+        }
+        HeldLock& held = *entry;
+        uint32_t& count = write ? held.intent_write : held.intent_read;
+        // the parents above are locked already if this thread holds this one the same way
+        if (count > 0) {
+            ++count;
+            break;
+        }
+        // a covered read lock does not hold the lock in shared memory
+        bool own_read = held.read > 0 && !held.read_cover;
+        if (!field->mutex.try_intention_lock(write, deadline, field->get_reader_slots(),
+                                             own_read, held.owned())) {
+            locks.drop(held);
+            unlock_parents_(write, field);
+            return false;
+        }
+        ++count;
+        held.journal = LockJournal::record(held.journal, field->mutex, field->get_reader_slots(),
+                                           write ? LockJournal::INTENT_WRITE
+                                                 : LockJournal::INTENT_READ);
+    }
+    return true;
 }
 
-void FieldTypeBase::write_unlock_() const {
-    mutex.write_unlock();
-    if (parent_field) { parent_field->read_or_write_unlock_(); }
+void FieldTypeBase::unlock_parents_(bool write, const FieldTypeBase* stop) const {
+    HeldLocks& locks = held_locks;
+    for (const FieldTypeBase* field = parent_field.get(); field != stop;
+         field = field->parent_field.get()) {
+        HeldLock& held = locks.get(field);
+        uint32_t& count = write ? held.intent_write : held.intent_read;
+        if (--count > 0) { break; }
+        held.journal = LockJournal::drop(held.journal, write ? LockJournal::INTENT_WRITE
+                                                             : LockJournal::INTENT_READ);
+        locks.drop(held);
+        field->mutex.intention_unlock(write, field->get_reader_slots());
+    }
 }
 
-void FieldTypeBase::read_or_write_lock_() const {
-    if (parent_field) { parent_field->read_or_write_lock_(); }
-    mutex.read_or_write_lock();
+size_t FieldTypeBase::read_versions(uint32_t* versions) const {
+    size_t count = 0;
+    for (const FieldTypeBase* field = this; field; field = field->parent_field.get()) {
+        if (count == MAX_OPTIMISTIC_DEPTH) { return 0; }
+        versions[count] = field->mutex.read_version();
+        if (versions[count] == SpinMutex::NO_VERSION) { return 0; }
+        ++count;
+    }
+    return count;
 }
 
-void FieldTypeBase::read_or_write_unlock_() const {
-    mutex.read_or_write_unlock();
-    if (parent_field) { parent_field->read_or_write_unlock_(); }
+bool FieldTypeBase::check_versions(const uint32_t* versions, size_t count) const {
+    const FieldTypeBase* field = this;
+    for (size_t idx = 0; idx < count; ++idx, field = field->parent_field.get()) {
+        if (!field->mutex.check_version(versions[idx])) { return false; }
+    }
+    return true;
+}
+
+void FieldTypeBase::read_lock_() const {
+    LockDeadline deadline{*this};
+    if (!try_read_lock_(deadline)) { throw std::runtime_error("timeout while getting read lock"); }
+}
+
+void FieldTypeBase::write_lock_() const {
+    LockDeadline deadline{*this};
+    if (!try_write_lock_(deadline)) { throw std::runtime_error("timeout while getting write lock"); }
 }
 
 std::unordered_map<std::type_index, type_hash_t>& typing::get_type_hashes() {
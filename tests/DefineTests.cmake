@@ -15,6 +15,7 @@ list(APPEND TEST_TARGETS test_alloc)
 list(APPEND TEST_TARGETS test_offsetptr)
 list(APPEND TEST_TARGETS test_basic_0)
 list(APPEND TEST_TARGETS test_basic_1)
+list(APPEND TEST_TARGETS test_lock)
 list(APPEND TEST_TARGETS test_mystruct0)
 list(APPEND TEST_TARGETS test_mystruct1)
 list(APPEND TEST_TARGETS test_utils)
@@ -24,6 +25,16 @@ foreach(TEST_TARGET ${TEST_TARGETS})
     add_test(NAME ${TEST_TARGET} COMMAND ${TEST_TARGET})
 endforeach()
 
+# benchmarks are built, but not run as tests
+set(BENCH_TARGETS "")
+list(APPEND BENCH_TARGETS bench_alloc)
+list(APPEND BENCH_TARGETS bench_lock)
+
+foreach(BENCH_TARGET ${BENCH_TARGETS})
+    add_executable(${BENCH_TARGET} ${STRUCTSTORE_TESTS_DIR}/${BENCH_TARGET}.cpp)
+    list(APPEND TEST_TARGETS ${BENCH_TARGET})
+endforeach()
+
 if(${BUILD_WITH_PYTHON})
     add_structstore_binding(mystruct0_py ${STRUCTSTORE_TESTS_DIR}/mystruct0_py.cpp)
     target_link_libraries(mystruct0_py PRIVATE ${TEST_LIB_TARGETS})
@@ -0,0 +1,99 @@
+#include <structstore/structstore.hpp>
+
+#include <chrono>
+#include <iostream>
+#include <random>
+#include <thread>
+#include <vector>
+
+namespace stst = structstore;
+
+// allocation throughput of concurrent writer threads on one shared arena
+static double bench_threads(stst::SharedAlloc& sh_alloc, int thread_count) {
+    constexpr int iterations = 200'000;
+    auto start = std::chrono::steady_clock::now();
+    std::vector<std::thread> threads;
+    for (int t = 0; t < thread_count; ++t) {
+        threads.emplace_back([&sh_alloc]() {
+            void* ptrs[16];
+            for (int i = 0; i < iterations; i += 16) {
+                for (int j = 0; j < 16; ++j) { ptrs[j] = sh_alloc.allocate(8 * (1 + j % 8)); }
+                for (int j = 0; j < 16; ++j) { sh_alloc.deallocate(ptrs[j]); }
+            }
+        });
+    }
+    for (auto& thread: threads) { thread.join(); }
+    double secs = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    return 2.0 * iterations * thread_count / secs;
+}
+
+// mixed alloc/free of large matrix buffers, which all land in the largest size class
+static double bench_matrices(stst::SharedAlloc& sh_alloc) {
+    constexpr int iterations = 20'000;
+    std::mt19937 rng{42};
+    std::uniform_int_distribution<size_t> dim_dist{256, 640};
+    std::vector<void*> ptrs;
+    auto start = std::chrono::steady_clock::now();
+    for (int i = 0; i < iterations; ++i) {
+        if (ptrs.size() < 64 && (ptrs.size() < 16 || rng() % 2 == 0)) {
+            size_t rows = dim_dist(rng), cols = dim_dist(rng);
+            ptrs.push_back(sh_alloc.allocate(rows * cols * sizeof(double)));
+        } else {
+            size_t idx = rng() % ptrs.size();
+            sh_alloc.deallocate(ptrs[idx]);
+            ptrs[idx] = ptrs.back();
+            ptrs.pop_back();
+        }
+    }
+    double secs = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    for (void* ptr: ptrs) { sh_alloc.deallocate(ptr); }
+    return iterations / secs;
+}
+
+// builds a snapshot store with many fields, which is then dropped at once
+static double bench_snapshot(stst::AllocMode mode) {
+    constexpr int field_count = 100'000;
+    constexpr size_t size = 1 << 26;
+    std::vector<uint64_t> buffer(size / sizeof(uint64_t));
+    auto* sh_alloc = new (buffer.data()) stst::SharedAlloc(buffer.data() + 16, size - 128, mode);
+    auto* store = new (sh_alloc->allocate<stst::StructStore>()) stst::StructStore(*sh_alloc);
+    auto start = std::chrono::steady_clock::now();
+    for (int i = 0; i < field_count; ++i) {
+        stst::StructStore& frame = (*store)[std::to_string(i % 1000)];
+        frame[std::to_string(i / 1000)] = (double) i;
+    }
+    double secs = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    if (mode == stst::BUMP_POINTER) {
+        sh_alloc->reset();
+    } else {
+        store->~StructStore();
+        sh_alloc->deallocate(store);
+    }
+    sh_alloc->~SharedAlloc();
+    return field_count / secs;
+}
+
+int main() {
+    constexpr size_t size = 1 << 24;
+    std::vector<uint64_t> buffer(size / sizeof(uint64_t));
+    auto* sh_alloc = new (buffer.data()) stst::SharedAlloc(buffer.data() + 16, size - 128);
+    for (int thread_count: {1, 2, 4, 8}) {
+        double ops = bench_threads(*sh_alloc, thread_count);
+        std::cout << "threads: " << thread_count << ", Mops/s: " << ops / 1e6 << std::endl;
+    }
+    sh_alloc->~SharedAlloc();
+
+    constexpr size_t big_size = size_t(1) << 30;
+    std::vector<uint64_t> big_buffer(big_size / sizeof(uint64_t));
+    auto* big_alloc = new (big_buffer.data()) stst::SharedAlloc(big_buffer.data() + 16, big_size - 128);
+    double ops = bench_matrices(*big_alloc);
+    std::cout << "large matrices, Mops/s: " << ops / 1e6 << std::endl;
+    big_alloc->~SharedAlloc();
+
+    for (stst::AllocMode mode: {stst::MINI_MALLOC, stst::BUMP_POINTER}) {
+        double fields = bench_snapshot(mode);
+        std::cout << "snapshot" << (mode == stst::BUMP_POINTER ? " (bump)" : "")
+                  << ", Mfields/s: " << fields / 1e6 << std::endl;
+    }
+    return 0;
+}
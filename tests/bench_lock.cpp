@@ -0,0 +1,166 @@
+#include <structstore/structstore.hpp>
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <ctime>
+#include <iostream>
+#include <optional>
+#include <thread>
+#include <vector>
+
+namespace stst = structstore;
+
+struct LockBenchResult {
+    double ops;
+    // CPU time of all threads per wall-clock time
+    double cpu_load;
+};
+
+// write lock throughput of more threads than cores contending for one lock, each holding it
+// for a short critical section
+static LockBenchResult bench_contention(stst::SpinMutex::WaitMode mode, int thread_count) {
+    constexpr int iterations = 20'000;
+    stst::SpinMutex::set_wait_mode(mode);
+    stst::SpinMutex mutex;
+    volatile uint64_t counter = 0;
+    std::clock_t cpu_start = std::clock();
+    auto start = std::chrono::steady_clock::now();
+    std::vector<std::thread> threads;
+    for (int t = 0; t < thread_count; ++t) {
+        threads.emplace_back([&]() {
+            for (int i = 0; i < iterations; ++i) {
+                stst::ScopedLock<true> lock{mutex};
+                for (int j = 0; j < 100; ++j) { counter = counter + 1; }
+            }
+        });
+    }
+    for (auto& thread: threads) { thread.join(); }
+    double secs = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    double cpu_secs = double(std::clock() - cpu_start) / CLOCKS_PER_SEC;
+    return {double(iterations) * thread_count / secs, cpu_secs / secs};
+}
+
+// read lock throughput of threads which only read a field of a store, whose readers are
+// counted either in its lock word or in reader slots
+static double bench_readers(bool scalable, int thread_count) {
+    constexpr int iterations = 200'000;
+    stst::StructStoreShared shstore("/stst_bench_lock", 1 << 16, true, false, stst::ALWAYS);
+    stst::StructStore& store = shstore["store"];
+    if (scalable) {
+        // readers lock all parents, thus each of them needs slots
+        shstore->make_read_scalable();
+        store.make_read_scalable();
+    }
+    stst::List& list = store["list"];
+    auto start = std::chrono::steady_clock::now();
+    std::vector<std::thread> threads;
+    for (int t = 0; t < thread_count; ++t) {
+        threads.emplace_back([&]() {
+            for (int i = 0; i < iterations; ++i) { auto lock = list.read_lock(); }
+        });
+    }
+    for (auto& thread: threads) { thread.join(); }
+    double secs = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    return double(iterations) * thread_count / secs;
+}
+
+// lock throughput of a field depth levels deep, with and without holding a lock on the root,
+// below which the parents are not locked again
+static double bench_deep_field(int depth, bool root_locked) {
+    constexpr int iterations = 200'000;
+    stst::StructStoreShared shstore("/stst_bench_lock", 1 << 16, true, false, stst::ALWAYS);
+    stst::StructStore* store = &*shstore;
+    for (int level = 1; level < depth; ++level) { store = &store->substore("sub"); }
+    stst::List& list = (*store)["list"];
+    std::optional<stst::ScopedFieldLock<false>> root_lock;
+    if (root_locked) { root_lock.emplace(shstore->read_lock()); }
+    auto start = std::chrono::steady_clock::now();
+    for (int i = 0; i < iterations; ++i) { auto lock = list.read_lock(); }
+    double secs = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    return iterations / secs;
+}
+
+struct WriterLatencyResult {
+    // sorted, in microseconds
+    std::vector<double> latencies;
+    int timeouts;
+};
+
+// latencies of write locks of a field which reader_count threads read continuously, each
+// holding the lock for a while
+static WriterLatencyResult bench_writer_latency(bool writer_preference, int reader_count) {
+    constexpr int iterations = 100;
+    constexpr double timeout = 0.1;
+    stst::StructStoreShared shstore("/stst_bench_lock", 1 << 16, true, false, stst::ALWAYS);
+    // only the writer gives up
+    shstore.set_lock_timeout(stst::LockDeadline::FOREVER);
+    stst::List& list = shstore["list"];
+    stst::SpinMutex::set_writer_preference(writer_preference);
+    std::atomic_bool stop{false};
+    std::vector<std::thread> readers;
+    for (int t = 0; t < reader_count; ++t) {
+        readers.emplace_back([&]() {
+            while (!stop) {
+                auto lock = list.read_lock();
+                std::this_thread::sleep_for(std::chrono::microseconds(100));
+            }
+        });
+    }
+    WriterLatencyResult result{{}, 0};
+    for (int i = 0; i < iterations; ++i) {
+        std::this_thread::sleep_for(std::chrono::microseconds(500));
+        auto start = std::chrono::steady_clock::now();
+        auto lock = list.try_write_lock(timeout);
+        if (!lock) { ++result.timeouts; }
+        result.latencies.push_back(
+                std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - start)
+                        .count());
+    }
+    stop = true;
+    for (auto& reader: readers) { reader.join(); }
+    stst::SpinMutex::set_writer_preference(false);
+    std::sort(result.latencies.begin(), result.latencies.end());
+    return result;
+}
+
+int main() {
+    int cores = std::max(1u, std::thread::hardware_concurrency());
+    for (int thread_count: {1, cores, 2 * cores, 4 * cores}) {
+        for (stst::SpinMutex::WaitMode mode: {stst::SpinMutex::YIELD, stst::SpinMutex::FUTEX}) {
+            LockBenchResult result = bench_contention(mode, thread_count);
+            std::cout << "threads: " << thread_count
+                      << (mode == stst::SpinMutex::FUTEX ? " (futex)" : " (yield)")
+                      << ", Mlocks/s: " << result.ops / 1e6 << ", cpu load: " << result.cpu_load
+                      << std::endl;
+        }
+    }
+    for (int thread_count = 1; thread_count <= std::max(cores, 2); thread_count *= 2) {
+        for (bool scalable: {false, true}) {
+            std::cout << "readers: " << thread_count << (scalable ? " (slots)" : " (lock word)")
+                      << ", Mlocks/s: " << bench_readers(scalable, thread_count) / 1e6
+                      << std::endl;
+        }
+    }
+    for (int depth: {1, 4, 16}) {
+        for (bool root_locked: {false, true}) {
+            std::cout << "depth: " << depth << (root_locked ? " (root locked)" : "")
+                      << ", Mlocks/s: " << bench_deep_field(depth, root_locked) / 1e6 << std::endl;
+        }
+    }
+    for (int reader_count: {1, 4, 16}) {
+        for (bool writer_preference: {false, true}) {
+            WriterLatencyResult result = bench_writer_latency(writer_preference, reader_count);
+            const std::vector<double>& latencies = result.latencies;
+            auto percentile = [&](double p) {
+                return latencies[size_t(p * double(latencies.size() - 1))];
+            };
+            std::cout << "writer latency, readers: " << reader_count
+                      << (writer_preference ? " (writer preference)" : "")
+                      << ", us p50: " << percentile(0.5) << ", p99: " << percentile(0.99)
+                      << ", max: " << latencies.back() << ", timeouts: " << result.timeouts
+                      << std::endl;
+        }
+    }
+    return 0;
+}
@@ -2,15 +2,34 @@
 
 #include <structstore/structstore.hpp>
 
+#include <algorithm>
+#include <atomic>
+#include <cstring>
+#include <random>
+#include <thread>
+#include <vector>
+
+#include <sys/mman.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
 namespace stst = structstore;
 
 TEST(StructStoreTestAlloc, structSizes) {
-    EXPECT_EQ(sizeof(stst::SpinMutex), 8);
-    EXPECT_EQ(sizeof(stst::FieldTypeBase), 12);
+    EXPECT_EQ(sizeof(stst::SpinMutex), 16);
+#ifdef STST_ARENA_64BIT
+    EXPECT_EQ(sizeof(stst::FieldTypeBase), 24);
+    EXPECT_EQ(sizeof(stst::Field), 16);
+    EXPECT_EQ(sizeof(stst::String), 64);
+    EXPECT_EQ(sizeof(stst::StructStore), 168);
+    EXPECT_EQ(sizeof(stst::SharedAlloc), 128);
+#else
+    EXPECT_EQ(sizeof(stst::FieldTypeBase), 24);
     EXPECT_EQ(sizeof(stst::Field), 8);
-    EXPECT_EQ(sizeof(stst::String), 56);
-    EXPECT_EQ(sizeof(stst::StructStore), 136);
-    EXPECT_EQ(sizeof(stst::SharedAlloc), 20);
+    EXPECT_EQ(sizeof(stst::String), 64);
+    EXPECT_EQ(sizeof(stst::StructStore), 160);
+    EXPECT_EQ(sizeof(stst::SharedAlloc), 80);
+#endif
 }
 
 TEST(StructStoreTestAlloc, bigAlloc) {
@@ -28,11 +47,499 @@ TEST(StructStoreTestAlloc, bigAlloc) {
             std::runtime_error);
 }
 
+TEST(StructStoreTestAlloc, arenaSizeLimit) {
+    alignas(8) uint8_t buffer[64];
+    EXPECT_THROW(stst::SharedAlloc(buffer, stst::SharedAlloc::MAX_SIZE + 1), std::runtime_error);
+}
+
 TEST(StructStoreTestAlloc, isOwned) {
     EXPECT_FALSE(stst::static_alloc.is_owned(nullptr));
     EXPECT_FALSE(stst::static_alloc.is_owned(&stst::static_alloc));
 }
 
+TEST(StructStoreTestAlloc, threadCaches) {
+    std::vector<uint64_t> buffer((1 << 20) / sizeof(uint64_t));
+    auto* sh_alloc = new (buffer.data()) stst::SharedAlloc(buffer.data() + 16, (1 << 20) - 128);
+    std::vector<std::thread> threads;
+    for (int t = 0; t < 8; ++t) {
+        threads.emplace_back([sh_alloc, t]() {
+            std::vector<std::pair<int*, int>> ptrs;
+            for (int i = 0; i < 10'000; ++i) {
+                int* ptr = sh_alloc->allocate<int>(8 * (1 + (i + t) % 20));
+                *ptr = i;
+                ptrs.emplace_back(ptr, i);
+                if (i % 3 == 0 || ptrs.size() > 100) {
+                    for (auto [p, value]: ptrs) {
+                        EXPECT_EQ(*p, value);
+                        sh_alloc->deallocate(p);
+                    }
+                    ptrs.clear();
+                }
+            }
+            for (auto [p, value]: ptrs) { sh_alloc->deallocate(p); }
+        });
+    }
+    for (auto& thread: threads) { thread.join(); }
+    // this checks that the cached blocks were returned to the arena
+    EXPECT_NO_THROW(sh_alloc->~SharedAlloc());
+}
+
+TEST(StructStoreTestAlloc, flushThreadCaches) {
+    constexpr size_t size = 1 << 20;
+    // shared with a child process, like a mapped segment
+    void* mem = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+    ASSERT_NE(mem, MAP_FAILED);
+    auto* sh_alloc = new (mem) stst::SharedAlloc((uint8_t*) mem + 128, size - 128);
+    size_t used = sh_alloc->stats().used_bytes;
+    pid_t pid = fork();
+    if (pid == 0) {
+        // leaves a filled cache behind
+        sh_alloc->deallocate(sh_alloc->allocate(64));
+        _exit(0);
+    }
+    waitpid(pid, nullptr, 0);
+    EXPECT_GT(sh_alloc->stats().used_bytes, used);
+    // the cache of the exited process is reclaimed
+    sh_alloc->flush_thread_caches();
+    EXPECT_EQ(sh_alloc->stats().used_bytes, used);
+
+    void* ptr = sh_alloc->allocate(64);
+    std::atomic_int step{0};
+    std::thread thread{[&]() {
+        sh_alloc->deallocate(sh_alloc->allocate(64));
+        step = 1;
+        while (step != 2) { std::this_thread::yield(); }
+        sh_alloc->deallocate(ptr);
+        step = 3;
+    }};
+    while (step != 1) { std::this_thread::yield(); }
+    // the cache of the other thread is only flushed by itself
+    sh_alloc->flush_thread_caches();
+    size_t requested = sh_alloc->stats().used_bytes;
+    step = 2;
+    while (step != 3) { std::this_thread::yield(); }
+    EXPECT_LT(sh_alloc->stats().used_bytes, requested);
+    thread.join();
+    EXPECT_NO_THROW(sh_alloc->~SharedAlloc());
+    munmap(mem, size);
+}
+
+TEST(StructStoreTestAlloc, threadCacheRefs) {
+    constexpr size_t size = 1 << 17;
+    std::vector<std::vector<uint64_t>> buffers(12, std::vector<uint64_t>(size / sizeof(uint64_t)));
+    // a freed block stays in the cache of the current thread, if it has one
+    auto has_cache = [](stst::SharedAlloc* sh_alloc) {
+        size_t used = sh_alloc->stats().used_bytes;
+        sh_alloc->deallocate(sh_alloc->allocate(64));
+        return sh_alloc->stats().used_bytes > used;
+    };
+    std::thread([&]() {
+        // arenas destroyed before do not use up the caches a thread keeps track of
+        for (auto& buffer: buffers) {
+            auto* sh_alloc = new (buffer.data()) stst::SharedAlloc(buffer.data() + 16, size - 128);
+            EXPECT_TRUE(has_cache(sh_alloc));
+            sh_alloc->~SharedAlloc();
+        }
+    }).join();
+    // an arena whose only cache is taken does not disable caching for a new arena at the same
+    // address
+    std::vector<uint64_t>& buffer = buffers[0];
+    auto* sh_alloc = new (buffer.data()) stst::SharedAlloc(buffer.data() + 16, size - 128);
+    std::atomic_int step{0};
+    std::thread owner{[&]() {
+        EXPECT_TRUE(has_cache(sh_alloc));
+        step = 1;
+        while (step != 2) { std::this_thread::yield(); }
+    }};
+    while (step != 1) { std::this_thread::yield(); }
+    EXPECT_FALSE(has_cache(sh_alloc));
+    sh_alloc->~SharedAlloc();
+    sh_alloc = new (buffer.data()) stst::SharedAlloc(buffer.data() + 16, size - 128);
+    EXPECT_TRUE(has_cache(sh_alloc));
+    step = 2;
+    owner.join();
+    EXPECT_NO_THROW(sh_alloc->~SharedAlloc());
+}
+
+TEST(StructStoreTestAlloc, stats) {
+    std::vector<uint64_t> buffer((1 << 16) / sizeof(uint64_t));
+    // too small for thread caches, so that all blocks are counted exactly
+    auto* sh_alloc = new (buffer.data()) stst::SharedAlloc(buffer.data() + 16, 1 << 15);
+    stst::mm_stats base = sh_alloc->stats();
+    EXPECT_EQ(base.total_bytes, size_t(1) << 15);
+    EXPECT_DOUBLE_EQ(base.fragmentation, 0.0);
+    EXPECT_EQ(base.largest_free_block, base.free_bytes);
+
+    std::vector<void*> ptrs;
+    for (int i = 0; i < 20; ++i) { ptrs.push_back(sh_alloc->allocate(512)); }
+    stst::mm_stats stats = sh_alloc->stats();
+    EXPECT_EQ(stats.allocation_count, base.allocation_count + 20);
+    EXPECT_EQ(stats.used_bytes, base.used_bytes + 20 * 512);
+    EXPECT_LT(stats.free_bytes, base.free_bytes - 20 * 512);
+
+    // freeing every other block leaves holes
+    for (size_t i = 0; i < ptrs.size(); i += 2) { sh_alloc->deallocate(ptrs[i]); }
+    stats = sh_alloc->stats();
+    EXPECT_EQ(stats.allocation_count, base.allocation_count + 10);
+    EXPECT_GT(stats.fragmentation, 0.0);
+    size_t class_free_bytes = 0;
+    for (size_t i = 0; i < stst::MM_SIZE_CLASSES; ++i) {
+        class_free_bytes += stats.class_free_bytes[i];
+    }
+    EXPECT_EQ(class_free_bytes, stats.free_bytes);
+
+    EXPECT_THROW(sh_alloc->allocate(1 << 16), std::runtime_error);
+    for (size_t i = 1; i < ptrs.size(); i += 2) { sh_alloc->deallocate(ptrs[i]); }
+    stats = sh_alloc->stats();
+    EXPECT_EQ(stats.failed_allocations, base.failed_allocations + 1);
+    EXPECT_EQ(stats.high_water_bytes, base.used_bytes + 20 * 512);
+    EXPECT_EQ(stats.used_bytes, base.used_bytes);
+    EXPECT_EQ(stats.free_bytes, base.free_bytes);
+    EXPECT_DOUBLE_EQ(stats.fragmentation, 0.0);
+    EXPECT_NO_THROW(sh_alloc->~SharedAlloc());
+}
+
+TEST(StructStoreTestAlloc, slabs) {
+    std::vector<uint64_t> buffer((1 << 17) / sizeof(uint64_t));
+    auto* sh_alloc = new (buffer.data()) stst::SharedAlloc(buffer.data() + 16, (1 << 17) - 128);
+    stst::mm_stats base = sh_alloc->stats();
+    std::vector<std::pair<uint64_t*, size_t>> ptrs;
+    for (size_t i = 0; i < 1000; ++i) {
+        auto* ptr = sh_alloc->allocate<uint64_t>();
+        *ptr = i;
+        ptrs.emplace_back(ptr, 1);
+    }
+    // slots have no headers, only each slab has one; otherwise, this would take 16 bytes each
+    EXPECT_LT(base.free_bytes - sh_alloc->stats().free_bytes, 1000 * 10);
+    for (size_t i = 0; i < 1000; ++i) {
+        size_t size = 1 + i % stst::Slab::MAX_SLOT_SIZE;
+        auto* ptr = (uint64_t*) sh_alloc->allocate(size);
+        std::memset(ptr, 0xff, size);
+        *ptr = i;
+        ptrs.emplace_back(ptr, size);
+    }
+    for (size_t i = 0; i < ptrs.size(); ++i) {
+        EXPECT_EQ(*ptrs[i].first, i % 1000);
+        EXPECT_EQ((size_t) ptrs[i].first % 8, 0);
+    }
+    for (size_t i = 0; i < ptrs.size(); i += 2) { sh_alloc->deallocate(ptrs[i].first); }
+    for (size_t i = 1; i < ptrs.size(); i += 2) { sh_alloc->deallocate(ptrs[i].first); }
+    sh_alloc->release_thread_caches();
+    // at most one empty slab per size class is kept; the free bytes also depend on how many
+    // free nodes the slabs split the remaining memory into, whose header size differs between
+    // the arena layouts
+    stst::mm_stats stats = sh_alloc->stats();
+    EXPECT_LE(stats.used_bytes - base.used_bytes, stst::Slab::CLASSES * stst::Slab::SIZE);
+    EXPECT_LE(stats.allocation_count - base.allocation_count, stst::Slab::CLASSES);
+    EXPECT_NO_THROW(sh_alloc->~SharedAlloc());
+}
+
+TEST(StructStoreTestAlloc, realloc) {
+    std::vector<uint64_t> buffer((1 << 15) / sizeof(uint64_t));
+    auto* mm = (stst::mini_malloc*) buffer.data();
+    stst::init_mini_malloc(mm, 1 << 15);
+    auto* ptr = (uint8_t*) stst::mm_allocate(mm, 100);
+    std::memset(ptr, 42, 100);
+    EXPECT_EQ(stst::mm_realloc(mm, ptr, 1000), ptr);
+    EXPECT_GE(stst::mm_block_size(ptr), 1000);
+    void* other = stst::mm_allocate(mm, 100);
+    // the block behind ptr is taken now, thus it has to be moved
+    auto* moved = (uint8_t*) stst::mm_realloc(mm, ptr, 4000);
+    EXPECT_NE(moved, ptr);
+    EXPECT_TRUE(std::all_of(moved, moved + 100, [](uint8_t b) { return b == 42; }));
+    EXPECT_TRUE(stst::mm_resize(mm, moved, 200));
+    EXPECT_LT(stst::mm_block_size(moved), 1000);
+    EXPECT_EQ(stst::mm_realloc(mm, moved, 1 << 16), nullptr);
+    EXPECT_EQ(stst::mm_realloc(mm, moved, 0), nullptr);
+    stst::mm_free(mm, other);
+    EXPECT_NO_THROW(stst::mm_assert_all_freed(mm));
+}
+
+TEST(StructStoreTestAlloc, checkBlock) {
+    std::vector<uint64_t> buffer((1 << 21) / sizeof(uint64_t));
+    auto* mm = (stst::mini_malloc*) buffer.data();
+    stst::init_mini_malloc(mm, 1 << 21);
+    std::vector<void*> ptrs;
+    for (size_t size = 8; size < 100'000; size = size * 3 / 2 + 8) {
+        ptrs.push_back(stst::mm_allocate(mm, size));
+        ptrs.push_back(stst::mm_allocate(mm, 16));
+    }
+    // free blocks of all sizes, in the lists and in the treap
+    for (size_t idx = 0; idx < ptrs.size(); idx += 2) { stst::mm_free(mm, ptrs[idx]); }
+    EXPECT_NO_THROW(stst::mm_check(mm));
+    // a node which was half split by a dead process
+    // the size is the first of the two words before the block
+    auto* size = (stst::arena_size_type*) ptrs[3] - 2;
+    *size += 8;
+    EXPECT_THROW(stst::mm_check(mm), std::runtime_error);
+    *size -= 8;
+    EXPECT_NO_THROW(stst::mm_check(mm));
+}
+
+TEST(StructStoreTestAlloc, alignedAlloc) {
+    std::vector<uint64_t> buffer((1 << 16) / sizeof(uint64_t));
+    auto* mm = (stst::mini_malloc*) buffer.data();
+    stst::init_mini_malloc(mm, 1 << 16);
+    std::vector<void*> ptrs;
+    for (size_t alignment: {16, 64, 256, 4096}) {
+        for (size_t size: {1, 100, 5000}) {
+            ptrs.push_back(stst::mm_allocate(mm, 24));
+            void* ptr = stst::mm_allocate_aligned(mm, size, alignment);
+            ASSERT_NE(ptr, nullptr);
+            EXPECT_EQ((size_t) ptr % alignment, 0);
+            // the padding is given back, only the usual rounding remains
+            EXPECT_LT(stst::mm_block_size(ptr), size + 2 * alignment);
+            std::memset(ptr, 0xff, size);
+            ptrs.push_back(ptr);
+        }
+    }
+    for (void* ptr: ptrs) { stst::mm_free(mm, ptr); }
+    EXPECT_NO_THROW(stst::mm_assert_all_freed(mm));
+
+    std::vector<uint64_t> sh_buffer((1 << 20) / sizeof(uint64_t));
+    auto* sh_alloc =
+            new (sh_buffer.data()) stst::SharedAlloc(sh_buffer.data() + 16, (1 << 20) - 128);
+    {
+        // the store has to reside in the arena, since it holds offset pointers into it
+        auto* store = new (sh_alloc->allocate<stst::StructStore>()) stst::StructStore(*sh_alloc);
+        stst::Matrix& mat = (*store)["mat"];
+        size_t shape[2] = {3, 3};
+        mat.from(2, shape, nullptr);
+        EXPECT_EQ((size_t) mat.data() % stst::SharedAlloc::CACHE_LINE_ALIGN, 0);
+        mat.data()[8] = 42.0;
+        mat.set_alignment(stst::SharedAlloc::PAGE_ALIGN);
+        EXPECT_EQ((size_t) mat.data() % stst::SharedAlloc::PAGE_ALIGN, 0);
+        EXPECT_EQ(mat.data()[8], 42.0);
+        EXPECT_THROW(mat.set_alignment(48), std::runtime_error);
+        store->check();
+        store->~StructStore();
+        sh_alloc->deallocate(store);
+    }
+    sh_alloc->release_thread_caches();
+    EXPECT_NO_THROW(sh_alloc->~SharedAlloc());
+}
+
+TEST(StructStoreTestAlloc, compactBlock) {
+    std::vector<uint64_t> buffer((1 << 16) / sizeof(uint64_t));
+    auto* mm = (stst::mini_malloc*) buffer.data();
+    stst::init_mini_malloc(mm, 1 << 16);
+    void* low = stst::mm_allocate(mm, 1000);
+    void* mid = stst::mm_allocate(mm, 100);
+    auto* high = (uint8_t*) stst::mm_allocate(mm, 400);
+    stst::mm_free(mm, low);
+    // the lowest fitting block is taken, not the best fitting one
+    void* ptr = stst::mm_allocate_low(mm, 50, 8, high);
+    EXPECT_EQ(ptr, low);
+    EXPECT_EQ(stst::mm_allocate_low(mm, 2000, 8, high), nullptr);
+    auto* aligned = stst::mm_allocate_low(mm, 200, 256, high);
+    ASSERT_NE(aligned, nullptr);
+    EXPECT_EQ((size_t) aligned % 256, 0);
+    EXPECT_LT(aligned, mid);
+    for (void* p: {ptr, mid, aligned, (void*) high}) { stst::mm_free(mm, p); }
+    EXPECT_NO_THROW(stst::mm_assert_all_freed(mm));
+
+    std::vector<uint64_t> sh_buffer((1 << 20) / sizeof(uint64_t));
+    auto* sh_alloc =
+            new (sh_buffer.data()) stst::SharedAlloc(sh_buffer.data() + 16, (1 << 20) - 128);
+    void* first = sh_alloc->allocate(1000);
+    auto* block = (uint8_t*) sh_alloc->allocate(500);
+    std::memset(block, 42, 500);
+    sh_alloc->deallocate(first);
+    auto* moved = (uint8_t*) sh_alloc->compact_block(block);
+    EXPECT_EQ(moved, first);
+    EXPECT_TRUE(std::all_of(moved, moved + 500, [](uint8_t b) { return b == 42; }));
+    EXPECT_EQ(sh_alloc->compact_block(moved), moved);
+    sh_alloc->deallocate(moved);
+    EXPECT_NO_THROW(sh_alloc->~SharedAlloc());
+}
+
+TEST(StructStoreTestAlloc, compactionSteps) {
+    std::vector<uint8_t> arena(2000);
+    // the walk visits the blocks in another order than their addresses
+    std::vector<size_t> blocks;
+    for (size_t i = 0; i < 100; ++i) { blocks.push_back((i * 37) % 100 * 10); }
+    std::vector<int> moves(arena.size());
+    size_t cursor = 0;
+    int steps = 0;
+    do {
+        stst::Compaction compaction{arena.data(), 0.0, cursor};
+        compaction.run([&](stst::Compaction& c) {
+            for (size_t offset: blocks) {
+                if (c.stopped()) { return; }
+                if (c.next(arena.data() + offset)) { ++moves[offset]; }
+            }
+        });
+        cursor = compaction.get_next_block();
+        ++steps;
+        // fields removed or inserted between steps shift the others in the walk
+        if (steps % 3 == 0) { blocks.erase(blocks.begin()); }
+        if (steps % 5 == 0) { blocks.insert(blocks.begin(), 1000 + steps); }
+    } while (cursor != 0);
+    EXPECT_GT(steps, 50);
+    for (size_t offset: blocks) { EXPECT_LE(moves[offset], 1); }
+    // each block which was there all the time was handled exactly once
+    for (size_t offset: blocks) {
+        if (offset < 1000) { EXPECT_EQ(moves[offset], 1); }
+    }
+}
+
+TEST(StructStoreTestAlloc, stringStorage) {
+    std::vector<uint64_t> buffer((1 << 24) / sizeof(uint64_t));
+    auto* sh_alloc =
+            new (buffer.data()) stst::SharedAlloc(buffer.data() + 16, (1 << 24) - 128);
+    stst::StringStorage& strings = sh_alloc->strings();
+    EXPECT_EQ(strings.get_idx("foo"), 0);
+    stst::shr_string_idx foo_idx = strings.internalize("foo");
+    EXPECT_EQ(strings.internalize("foo"), foo_idx);
+    constexpr uint32_t foo_hash = stst::StringStorage::hash("foo");
+    EXPECT_EQ(strings.get_idx("foo", foo_hash), foo_idx);
+    // lookups do not allocate
+    size_t allocation_count = sh_alloc->stats().allocation_count;
+    EXPECT_EQ(strings.get_idx(std::string_view("foobar", 3)), foo_idx);
+    EXPECT_EQ(sh_alloc->stats().allocation_count, allocation_count);
+
+    // readers look up names while the table and its chunks grow
+    std::atomic_bool done{false};
+    std::thread reader([&]() {
+        while (!done) { ASSERT_EQ(strings.get_idx("foo"), foo_idx); }
+    });
+    std::vector<stst::shr_string_idx> indices;
+    for (int i = 0; i < 2000; ++i) { indices.push_back(strings.internalize(std::to_string(i))); }
+    done = true;
+    reader.join();
+    for (int i = 0; i < 2000; ++i) {
+        EXPECT_EQ(strings.get_idx(std::to_string(i)), indices[i]);
+        EXPECT_EQ(std::string_view(*strings.get(indices[i])), std::to_string(i));
+    }
+
+    // unreferenced strings are dropped and their indices reused
+    size_t size = strings.size();
+    for (int i = 0; i < 1000; ++i) { strings.release(indices[i]); }
+    EXPECT_EQ(strings.reclaim(), 1000);
+    EXPECT_EQ(strings.size(), size - 1000);
+    EXPECT_EQ(strings.get_idx("0"), 0);
+    EXPECT_EQ(strings.get_idx("1999"), indices[1999]);
+    EXPECT_EQ(strings.get_idx("foo"), foo_idx);
+    stst::shr_string_idx new_idx = strings.internalize("new");
+    EXPECT_LT(new_idx, indices[1999]);
+    EXPECT_EQ(std::string_view(*strings.get(new_idx)), "new");
+    // more names than fit into 16 bits
+    for (int i = 0; i < 70000; ++i) { strings.internalize("name" + std::to_string(i)); }
+    EXPECT_EQ(strings.get_idx("name69999"), strings.internalize("name69999"));
+    EXPECT_GT(strings.get_idx("name69999"), std::numeric_limits<uint16_t>::max());
+    EXPECT_NO_THROW(sh_alloc->~SharedAlloc());
+}
+
+TEST(StructStoreTestAlloc, bumpAlloc) {
+    std::vector<uint64_t> buffer((1 << 16) / sizeof(uint64_t));
+    auto* sh_alloc = new (buffer.data())
+            stst::SharedAlloc(buffer.data() + 16, (1 << 16) - 128, stst::BUMP_POINTER);
+    EXPECT_EQ(sh_alloc->get_mode(), stst::BUMP_POINTER);
+    size_t used_bytes = sh_alloc->stats().used_bytes;
+    auto* ptr1 = (uint8_t*) sh_alloc->allocate(3);
+    auto* ptr2 = (uint8_t*) sh_alloc->allocate(16);
+    // blocks have no headers
+    EXPECT_EQ(ptr2, ptr1 + 8);
+    sh_alloc->deallocate(ptr1);
+    EXPECT_EQ(sh_alloc->stats().used_bytes, used_bytes + 24);
+    auto* ptr3 = sh_alloc->allocate_aligned(100, 64);
+    EXPECT_EQ((size_t) ptr3 % 64, 0);
+    std::memset(ptr2, 42, 16);
+    auto* next = (uint8_t*) sh_alloc->allocate(16);
+    std::memset(next, 7, 16);
+    EXPECT_THROW(sh_alloc->reallocate(ptr2, 32), std::runtime_error);
+    auto* ptr4 = (uint8_t*) sh_alloc->reallocate(ptr2, 32, 16);
+    EXPECT_TRUE(std::all_of(ptr4, ptr4 + 16, [](uint8_t b) { return b == 42; }));
+    // the block following the old one is not copied
+    EXPECT_TRUE(std::all_of(ptr4 + 16, ptr4 + 32, [](uint8_t b) { return b == 0; }));
+    EXPECT_THROW(sh_alloc->allocate(1 << 16), std::runtime_error);
+
+    sh_alloc->reset();
+    EXPECT_EQ(sh_alloc->stats().used_bytes, used_bytes);
+    EXPECT_EQ(sh_alloc->allocate(3), ptr1);
+    EXPECT_NO_THROW(sh_alloc->~SharedAlloc());
+}
+
+TEST(StructStoreTestAlloc, vectorGrowth) {
+    std::vector<uint64_t> buffer((1 << 20) / sizeof(uint64_t));
+    auto* sh_alloc = new (buffer.data()) stst::SharedAlloc(buffer.data() + 16, (1 << 20) - 128);
+    {
+        stst::shr_vector<uint64_t> vec{stst::StlAllocator<uint64_t>(*sh_alloc)};
+        int moves = 0;
+        for (uint64_t i = 0; i < 10'000; ++i) {
+            uint64_t* data = vec.data();
+            vec.push_back(i);
+            moves += vec.data() != data;
+        }
+        // only the first small buffers are moved, afterwards the buffer grows in place
+        EXPECT_LT(moves, 8);
+        for (uint64_t i = 0; i < vec.size(); ++i) { EXPECT_EQ(vec[i], i); }
+
+        stst::shr_vector<stst::shr_string> strs{stst::StlAllocator<>(*sh_alloc)};
+        for (int i = 0; i < 100; ++i) {
+            strs.emplace_back(std::string(i, 'a').c_str(), stst::StlAllocator<>(*sh_alloc));
+        }
+        strs.erase(strs.begin());
+        strs.emplace(strs.begin() + 10, "b", stst::StlAllocator<>(*sh_alloc));
+        EXPECT_EQ(strs.size(), 100);
+        EXPECT_EQ(strs[9], stst::shr_string(10, 'a', stst::StlAllocator<>(*sh_alloc)));
+        EXPECT_EQ(strs[10], "b");
+        EXPECT_EQ(strs[99].size(), 99);
+    }
+    sh_alloc->release_thread_caches();
+    EXPECT_NO_THROW(sh_alloc->~SharedAlloc());
+}
+
+TEST(StructStoreTestAlloc, growArena) {
+    std::vector<uint64_t> buffer((1 << 20) / sizeof(uint64_t));
+    auto* sh_alloc = new (buffer.data()) stst::SharedAlloc(buffer.data() + 16, 1 << 14);
+    EXPECT_THROW(sh_alloc->allocate(1 << 14), std::runtime_error);
+    sh_alloc->set_grow_fn([](size_t blocksize, size_t size) {
+        return std::min((2 * blocksize + size) / 8 * 8, (size_t(1) << 20) - 128);
+    });
+    std::vector<void*> ptrs;
+    for (int i = 0; i < 1000; ++i) { ptrs.push_back(sh_alloc->allocate(256 + i)); }
+    EXPECT_GT(sh_alloc->size(), size_t(1) << 18);
+    EXPECT_TRUE(sh_alloc->is_owned(ptrs.back()));
+    EXPECT_THROW(sh_alloc->allocate(1 << 20), std::runtime_error);
+    for (void* ptr: ptrs) { sh_alloc->deallocate(ptr); }
+    // the grown memory is merged into one free block again
+    void* ptr = sh_alloc->allocate(sh_alloc->size() / 2);
+    sh_alloc->deallocate(ptr);
+    EXPECT_NO_THROW(sh_alloc->~SharedAlloc());
+}
+
+// allocates blocks of random sizes, some of them up to max_size bytes, and frees
+// random blocks in between, checking that no blocks overlap
+static void fragment_arena(size_t arena_size, size_t max_size, int allocs, int frees) {
+    std::vector<uint64_t> buffer(arena_size / sizeof(uint64_t));
+    auto* sh_alloc = new (buffer.data()) stst::SharedAlloc(buffer.data() + 16, arena_size - 128);
+    std::mt19937 rng{42};
+    std::vector<std::pair<uint8_t*, size_t>> blocks;
+    auto check_and_free = [&](size_t idx) {
+        auto [ptr, size] = blocks[idx];
+        for (size_t i = 0; i < size; i += 61) { ASSERT_EQ(ptr[i], (uint8_t) size); }
+        sh_alloc->deallocate(ptr);
+        blocks[idx] = blocks.back();
+        blocks.pop_back();
+    };
+    for (int round = 0; round < 20; ++round) {
+        for (int i = 0; i < allocs; ++i) {
+            size_t size = 1 + rng() % (rng() % 2 ? 64 : max_size);
+            auto* ptr = sh_alloc->allocate<uint8_t>(size);
+            std::memset(ptr, (uint8_t) size, size);
+            blocks.emplace_back(ptr, size);
+        }
+        for (int i = 0; i < frees; ++i) { check_and_free(rng() % blocks.size()); }
+    }
+    while (!blocks.empty()) { check_and_free(blocks.size() - 1); }
+    EXPECT_NO_THROW(sh_alloc->~SharedAlloc());
+}
+
+TEST(StructStoreTestAlloc, fragmentation) { fragment_arena(1 << 22, 2048, 500, 400); }
+
+TEST(StructStoreTestAlloc, bigFragmentation) { fragment_arena(1 << 28, 1 << 21, 100, 90); }
+
 int main(int argc, char** argv) {
     testing::InitGoogleTest(&argc, argv);
     return RUN_ALL_TESTS();
@@ -91,6 +91,260 @@ TEST(StructStoreTestBasic, sharedStore) {
     shsettings_store.check();
 }
 
+TEST(StructStoreTestBasic, growingSharedStore) {
+    stst::StructStoreShared store("/shgrowing_store", 4096, true, false, stst::ALWAYS, 1 << 20);
+    // opened before growing, this picks up the growth without remapping
+    stst::StructStoreShared reader("/shgrowing_store");
+    EXPECT_EQ(store.size(), reader.size());
+    stst::Matrix& mat = store["mat"];
+    size_t shape[2] = {64, 64};
+    mat.from(2, shape, nullptr);
+    mat.data()[64 * 64 - 1] = 42.0;
+    stst::List& list = store["list"];
+    for (int i = 0; i < 1000; ++i) { list.push_back(i); }
+    EXPECT_GT(store.size(), 64 * 64 * sizeof(double));
+    EXPECT_EQ(store.size(), reader.size());
+    EXPECT_EQ(reader["mat"].get<stst::Matrix>().data()[64 * 64 - 1], 42.0);
+    EXPECT_EQ(reader["list"].get<stst::List>().size(), 1000);
+    store.check();
+    reader.check();
+    // growing stops at the maximum size
+    size_t big_shape[2] = {1024, 1024};
+    EXPECT_THROW(mat.from(2, big_shape, nullptr), std::runtime_error);
+}
+
+TEST(StructStoreTestBasic, mapOptionsSharedStore) {
+    stst::StructStoreShared store("/shmapped_store", 1 << 16, true, false, stst::ALWAYS, 1 << 20,
+                                  stst::HUGE_PAGES | stst::PREFAULT | stst::LOCK_MEMORY);
+    stst::StructStoreShared reader("/shmapped_store", 0, false, false, stst::NEVER, 0,
+                                   stst::PREFAULT);
+    stst::List& list = store["list"];
+    for (int i = 0; i < 10000; ++i) { list.push_back(i); }
+    EXPECT_GT(store.size(), 1 << 16);
+    EXPECT_EQ(reader["list"].get<stst::List>().size(), 10000);
+    reader.check();
+
+    int fd = stst::StructStoreShared::create_memfd("memfd_store", 1 << 16, stst::PREFAULT);
+    {
+        stst::StructStoreShared memfd_store(fd, true, stst::PREFAULT);
+        memfd_store["num"] = 5;
+        stst::StructStoreShared memfd_reader(fd, false);
+        EXPECT_EQ(memfd_reader["num"].get<int>(), 5);
+    }
+    close(fd);
+}
+
+TEST(StructStoreTestBasic, bigFileBackedStore) {
+#ifndef STST_ARENA_64BIT
+    GTEST_SKIP() << "arenas larger than 2 GiB need BUILD_WITH_ARENA_64BIT";
+#else
+    // the file stays sparse, only the touched pages are written
+    stst::StructStoreShared store("/tmp/stst_big_store", size_t(6) << 30, true, true, stst::ALWAYS);
+    stst::Matrix& frames = store["frames"];
+    size_t frames_shape[2] = {size_t(1) << 16, size_t(1) << 13};
+    frames.from(2, frames_shape, nullptr);
+    size_t frames_count = frames_shape[0] * frames_shape[1];
+    frames.data()[0] = 1.0;
+    frames.data()[frames_count - 1] = 2.0;
+    stst::Matrix& cloud = store["cloud"];
+    size_t cloud_shape[1] = {size_t(1) << 20};
+    cloud.from(1, cloud_shape, nullptr);
+    cloud.data()[cloud_shape[0] - 1] = 3.0;
+    EXPECT_GT((uint8_t*) (cloud.data() + cloud_shape[0]) - (uint8_t*) store.addr(),
+              int64_t(1) << 32);
+    EXPECT_EQ(frames.data()[0], 1.0);
+    EXPECT_EQ(frames.data()[frames_count - 1], 2.0);
+    EXPECT_EQ(cloud.data()[cloud_shape[0] - 1], 3.0);
+    store.check();
+#endif
+}
+
+TEST(StructStoreTestBasic, subArena) {
+    stst::StructStoreShared store("/shsubarena_store", 1 << 20, true, false, stst::ALWAYS);
+    size_t used_bytes = store.stats().used_bytes;
+    stst::StructStore& sub = store["sub"];
+    sub.make_sub_arena(1 << 18);
+    EXPECT_TRUE(sub.has_sub_arena());
+    EXPECT_NE(&sub.get_alloc(), &store->get_alloc());
+    for (int i = 0; i < 100; ++i) {
+        stst::StructStore& entry = sub[std::to_string(i)];
+        entry["num"] = i;
+        entry["str"] = "foo";
+        stst::List& list = entry["list"];
+        for (int j = 0; j < 10; ++j) { list.push_back(j); }
+    }
+    size_t sub_used_bytes = store.stats().used_bytes;
+    EXPECT_GT(sub.get_alloc().stats().used_bytes, 100 * 10 * sizeof(int));
+    EXPECT_EQ(sub["42"]["num"].get<int>(), 42);
+    store.check();
+
+    // clearing drops the whole sub-arena at once
+    sub.clear();
+    EXPECT_TRUE(sub.empty());
+    EXPECT_EQ(store.stats().used_bytes, sub_used_bytes);
+    sub["num"] = 5;
+    EXPECT_EQ(sub["num"].get<int>(), 5);
+    store.check();
+    EXPECT_THROW(sub.make_sub_arena(1 << 16), std::runtime_error);
+
+    // only the interned name and cached blocks remain
+    store->remove("sub");
+    EXPECT_LT(store.stats().used_bytes, used_bytes + (1 << 12));
+}
+
+TEST(StructStoreTestBasic, bumpSharedStore) {
+    stst::StructStoreShared store("/shbump_store", 1 << 16, true, false, stst::ALWAYS, 1 << 20, 0,
+                                  stst::BUMP_POINTER);
+    for (int i = 0; i < 1000; ++i) { store[std::to_string(i)] = i; }
+    EXPECT_GT(store.size(), 1 << 16);
+    EXPECT_EQ(store["999"].get<int>(), 999);
+    store.check();
+    size_t used_bytes = store.stats().used_bytes;
+    store->remove("999");
+    EXPECT_EQ(store.stats().used_bytes, used_bytes);
+    store.reset();
+    EXPECT_TRUE(store->empty());
+    EXPECT_LT(store.stats().used_bytes, used_bytes / 10);
+    store["num"] = 5;
+    EXPECT_EQ(store["num"].get<int>(), 5);
+    store.check();
+}
+
+TEST(StructStoreTestBasic, compactSharedStore) {
+    stst::StructStoreShared store("/shcompact_store", 1 << 20, true, false, stst::ALWAYS);
+    std::string value(200, 'x');
+    size_t shape[2] = {8, 8};
+    for (int i = 0; i < 100; ++i) { store["tmp" + std::to_string(i)] = value; }
+    for (int i = 0; i < 100; ++i) {
+        store["str" + std::to_string(i)] = value + std::to_string(i);
+        stst::Matrix& mat = store["mat" + std::to_string(i)];
+        mat.from(2, shape, nullptr);
+        mat.data()[63] = i;
+    }
+    for (int i = 0; i < 100; ++i) { store->remove("tmp" + std::to_string(i)); }
+    auto max_data = [&]() {
+        const void* max_ptr = nullptr;
+        for (int i = 0; i < 100; ++i) {
+            stst::String& str = store["str" + std::to_string(i)];
+            stst::Matrix& mat = store["mat" + std::to_string(i)];
+            max_ptr = std::max<const void*>({max_ptr, str.data(), mat.data()});
+        }
+        return max_ptr;
+    };
+    const void* max_ptr = max_data();
+    size_t used_bytes = store.stats().used_bytes;
+    store.compact();
+    // the data has moved into the freed blocks
+    EXPECT_LT(max_data(), max_ptr);
+    // cached blocks were returned to the arena
+    EXPECT_LE(store.stats().used_bytes, used_bytes);
+    for (int i = 0; i < 100; ++i) {
+        EXPECT_EQ(store["str" + std::to_string(i)].get_str().c_str(), value + std::to_string(i));
+        EXPECT_EQ(store["mat" + std::to_string(i)].get<stst::Matrix>().data()[63], i);
+    }
+    store.check();
+
+    // a step without time moves a single block
+    for (int i = 0; i < 50; ++i) { store->remove("str" + std::to_string(i)); }
+    int steps = 1;
+    while (!store.compact_step(0.0)) { ++steps; }
+    EXPECT_GT(steps, 10);
+    EXPECT_EQ(store["mat99"].get<stst::Matrix>().data()[63], 99);
+    store.check();
+}
+
+TEST(StructStoreTestBasic, reclaimNames) {
+    stst::StructStoreShared store("/shreclaim_store", 1 << 20, true, false, stst::ALWAYS);
+    store["keep"] = 1;
+    size_t names = store.stats().used_bytes;
+    for (int round = 0; round < 10; ++round) {
+        for (int i = 0; i < 1000; ++i) { store["id" + std::to_string(round * 1000 + i)] = i; }
+        for (int i = 0; i < 1000; ++i) { store->remove("id" + std::to_string(round * 1000 + i)); }
+        EXPECT_EQ(store.reclaim_names(), 1000);
+        if (round == 0) { names = store.stats().used_bytes; }
+    }
+    // the names of later rounds reuse the slots of earlier ones, only cached blocks vary
+    EXPECT_LT(store.stats().used_bytes, names + (1 << 12));
+    EXPECT_EQ(store.reclaim_names(), 0);
+    // the names of sub-arenas are interned in their own tables, which are swept, too
+    stst::StructStore& sub = store["outer"]["arena"];
+    sub.make_sub_arena(1 << 16);
+    for (int i = 0; i < 100; ++i) { sub["sub" + std::to_string(i)] = i; }
+    for (int i = 1; i < 100; ++i) { sub.remove("sub" + std::to_string(i)); }
+    EXPECT_EQ(store.reclaim_names(), 99);
+    EXPECT_EQ(sub.get_alloc().strings().size(), 2);
+    EXPECT_EQ(sub["sub0"].get<int>(), 0);
+    EXPECT_EQ(store["keep"].get<int>(), 1);
+    store.check();
+}
+
+TEST(StructStoreTestBasic, fieldKeys) {
+    static_assert(stst::StringStorage::hash("num") == stst::const_hash("mun"));
+    stst::StructStoreShared store("/shkeys_store", 1 << 20, true, false, stst::ALWAYS);
+    static const stst::FieldKey num{"num"};
+    EXPECT_THROW(store->at(num), std::out_of_range);
+    store[num] = 5;
+    EXPECT_EQ(store["num"].get<int>(), 5);
+    for (int i = 0; i < 3; ++i) { store[num].get<int>() += 1; }
+    EXPECT_EQ(store->get<int>(num), 8);
+    EXPECT_EQ(&store->at(STST_KEY("num")).get<int>(), &store->get<int>("num"));
+    store[STST_KEY("sub")][num] = 2;
+    EXPECT_EQ(store["sub"]["num"].get<int>(), 2);
+    // dropping the name invalidates the cached index
+    store->remove("num");
+    store->remove("sub");
+    EXPECT_EQ(store.reclaim_names(), 2);
+    store["other1"] = 1;
+    store["other2"] = 2;
+    EXPECT_THROW(store->at(STST_KEY("num")), std::out_of_range);
+    store[num] = 3;
+    EXPECT_EQ(store["num"].get<int>(), 3);
+    EXPECT_EQ(store["other1"].get<int>(), 1);
+    EXPECT_EQ(store["other2"].get<int>(), 2);
+    // the key is used with more name tables than it caches, at different indices in each
+    std::vector<stst::StructStore*> subs;
+    for (int i = 0; i < 6; ++i) {
+        stst::StructStore& sub = store["arena" + std::to_string(i)];
+        sub.make_sub_arena(1 << 14);
+        for (int j = 0; j < i; ++j) { sub["pad" + std::to_string(j)] = j; }
+        sub[num] = i;
+        subs.push_back(&sub);
+    }
+    for (int round = 0; round < 3; ++round) {
+        for (int i = 0; i < 6; ++i) { EXPECT_EQ(subs[i]->get<int>(num), i); }
+        EXPECT_EQ(store->get<int>(num), 3);
+    }
+    store.check();
+}
+
+TEST(StructStoreTestBasic, fieldHandles) {
+    stst::StructStoreShared store("/shhandles_store", 1 << 20, true, false, stst::ALWAYS);
+    stst::FieldHandle<int> num = store.handle<int>("num");
+    *num = 5;
+    EXPECT_EQ(store["num"].get<int>(), 5);
+    // inserting other fields does not invalidate the handle
+    for (int i = 0; i < 100; ++i) { store["id" + std::to_string(i)] = i; }
+    EXPECT_EQ(&num.get(), &store->get<int>("num"));
+    // removing or clearing fields is detected, the field is then created again
+    store->remove("num");
+    EXPECT_EQ(*num, 0);
+    EXPECT_EQ(&num.get(), &store->get<int>("num"));
+    store["num"].clear();
+    store["num"] = 7;
+    EXPECT_EQ(*num, 7);
+    store->clear();
+    EXPECT_EQ(*num, 0);
+    EXPECT_EQ(&num.get(), &store->get<int>("num"));
+    stst::StructStore& sub = store["sub"];
+    sub.make_sub_arena(1 << 16);
+    auto str = sub.handle<stst::String>("str");
+    *str = "foo";
+    sub.clear();
+    EXPECT_TRUE(str->empty());
+    EXPECT_EQ(&str.get(), &sub.get<stst::String>("str"));
+    store.check();
+}
+
 TEST(StructStoreTestBasic, cmpEqual) {
     auto store_ref1 = stst::StructStore::create();
     stst::StructStore& store1 = *store_ref1;
@@ -0,0 +1,478 @@
+#include <gtest/gtest.h>
+
+#include <structstore/structstore.hpp>
+
+#include <atomic>
+#include <chrono>
+#include <stdexcept>
+#include <thread>
+#include <vector>
+
+#include <signal.h>
+#include <sys/mman.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+namespace stst = structstore;
+
+static void count_under_lock(stst::SpinMutex::WaitMode mode) {
+    stst::SpinMutex::set_wait_mode(mode);
+    stst::SpinMutex mutex;
+    int counter = 0;
+    std::vector<std::thread> threads;
+    for (int t = 0; t < 4; ++t) {
+        threads.emplace_back([&]() {
+            for (int i = 0; i < 20'000; ++i) {
+                stst::ScopedLock<true> lock{mutex};
+                ++counter;
+            }
+        });
+    }
+    for (auto& thread: threads) { thread.join(); }
+    EXPECT_EQ(counter, 80'000);
+    stst::SpinMutex::set_wait_mode(stst::SpinMutex::FUTEX);
+}
+
+TEST(StructStoreTestLock, writersExclusive) {
+    count_under_lock(stst::SpinMutex::YIELD);
+    count_under_lock(stst::SpinMutex::FUTEX);
+}
+
+TEST(StructStoreTestLock, sleepingWaiters) {
+    stst::SpinMutex mutex;
+    std::atomic_bool read_locked{false};
+    auto lock = std::make_unique<stst::ScopedLock<true>>(mutex);
+    std::thread reader{[&]() {
+        stst::ScopedLock<false> read_lock{mutex};
+        read_locked = true;
+    }};
+    std::this_thread::sleep_for(std::chrono::milliseconds(20));
+    EXPECT_FALSE(read_locked);
+    // the reader is woken up by the unlock
+    lock.reset();
+    reader.join();
+    EXPECT_TRUE(read_locked);
+}
+
+TEST(StructStoreTestLock, timeout) {
+    stst::SpinMutex mutex;
+    stst::ScopedLock<false> lock{mutex};
+    std::thread writer{[&]() {
+        try {
+            stst::ScopedLock<true> write_lock{mutex};
+            ADD_FAILURE() << "got write lock while read-locked";
+        } catch (const std::runtime_error& e) {
+            EXPECT_STREQ(e.what(), "timeout while getting write lock");
+        }
+    }};
+    writer.join();
+}
+
+TEST(StructStoreTestLock, tryLock) {
+    stst::StructStoreShared store("/shtrylock_store", 16384, true, false, stst::ALWAYS);
+    stst::List& list = store["list"];
+    {
+        auto lock = list.read_lock();
+        EXPECT_FALSE(list.try_write_lock(0.0));
+        auto start = std::chrono::steady_clock::now();
+        EXPECT_FALSE(list.try_write_lock(0.02));
+        EXPECT_GE(std::chrono::steady_clock::now() - start, std::chrono::milliseconds(20));
+        EXPECT_TRUE(list.try_read_lock(0.0));
+    }
+    EXPECT_TRUE(list.try_write_lock(0.0));
+    // a long reader does not make waiting writers of this store fail
+    store.set_lock_timeout(stst::LockDeadline::FOREVER);
+    std::atomic_bool written{false};
+    std::thread writer;
+    {
+        auto lock = list.read_lock();
+        writer = std::thread{[&]() {
+            auto write_lock = list.write_lock();
+            written = true;
+        }};
+        std::this_thread::sleep_for(std::chrono::milliseconds(200));
+        EXPECT_FALSE(written);
+    }
+    writer.join();
+    EXPECT_TRUE(written);
+    store.set_lock_timeout(0.0);
+    auto lock = list.read_lock();
+    std::thread([&]() {
+        EXPECT_THROW(auto write_lock = list.write_lock(), std::runtime_error);
+    }).join();
+}
+
+TEST(StructStoreTestLock, consistentRead) {
+    stst::StructStoreShared store("/shconsistent_store", 16384, true, false, stst::ALWAYS);
+    stst::StructStore& sub = store["sub"];
+    int& x = sub["x"];
+    int& y = sub["y"];
+    auto y_handle = sub.handle<int>("y");
+    std::atomic_bool stop{false};
+    std::thread writer{[&]() {
+        for (int i = 1; i <= 20'000; ++i) {
+            // locking the parent also invalidates optimistic reads of the children
+            auto lock = i % 2 ? store->write_lock() : sub.write_lock();
+            x = i;
+            y = i;
+        }
+        stop = true;
+    }};
+    int reads = 0;
+    while (!stop) {
+        int a, b;
+        sub.read_consistent([&]() {
+            a = x;
+            b = y;
+        });
+        EXPECT_EQ(a, b);
+        EXPECT_LE(b, y_handle.read());
+        ++reads;
+    }
+    writer.join();
+    EXPECT_GT(reads, 0);
+    EXPECT_EQ(y_handle.read(), 20'000);
+    // the write lock of the current thread does not prevent optimistic reads
+    {
+        auto lock = sub.write_lock();
+        EXPECT_EQ(y_handle.read(), 20'000);
+    }
+    sub.remove("y");
+    EXPECT_EQ(y_handle.read(), 0);
+    store.check();
+}
+
+TEST(StructStoreTestLock, scalableReaders) {
+    stst::StructStoreShared store("/shscalable_store", 16384, true, false, stst::ALWAYS);
+    stst::StructStore& sub = store["sub"];
+    sub.make_read_scalable();
+    EXPECT_TRUE(sub.is_read_scalable());
+    int& x = sub["x"];
+    int& y = sub["y"];
+    stst::List& list = sub["list"];
+    std::atomic_bool stop{false};
+    std::vector<std::thread> readers;
+    for (int t = 0; t < 4; ++t) {
+        readers.emplace_back([&]() {
+            while (!stop) {
+                // readers of fields below the store are counted in its slots
+                auto lock = list.read_lock();
+                EXPECT_EQ(x, y);
+            }
+        });
+    }
+    for (int i = 1; i <= 2'000; ++i) {
+        auto lock = sub.write_lock();
+        x = i;
+        y = i;
+    }
+    stop = true;
+    for (auto& thread: readers) { thread.join(); }
+    auto lock = list.read_lock();
+    std::thread([&]() {
+        EXPECT_FALSE(sub.try_write_lock(0.01));
+        EXPECT_TRUE(sub.try_read_lock(0.01));
+    }).join();
+    lock.unlock();
+    EXPECT_TRUE(sub.try_write_lock(0.0));
+    store.check();
+}
+
+TEST(StructStoreTestLock, intentionLocks) {
+    stst::StructStoreShared store("/shintention_store", 16384, true, false, stst::ALWAYS);
+    stst::StructStore& sub = store["sub"];
+    stst::List& list1 = sub["list1"];
+    stst::List& list2 = sub["list2"];
+    {
+        // writers of different fields do not exclude each other
+        auto lock = list1.write_lock();
+        std::thread([&]() { EXPECT_TRUE(list2.try_write_lock(0.0)); }).join();
+        // but readers and writers of the whole store
+        std::thread([&]() {
+            EXPECT_FALSE(sub.try_read_lock(0.0));
+            EXPECT_FALSE(store->try_write_lock(0.0));
+            EXPECT_TRUE(list2.try_read_lock(0.0));
+        }).join();
+    }
+    {
+        // readers of the store exclude writers below
+        auto lock = sub.read_lock();
+        std::thread([&]() {
+            EXPECT_FALSE(list1.try_write_lock(0.0));
+            EXPECT_TRUE(list1.try_read_lock(0.0));
+            EXPECT_TRUE(store->try_read_lock(0.0));
+        }).join();
+        // except those of the current thread
+        EXPECT_TRUE(list1.try_write_lock(0.0));
+    }
+    {
+        // locks below locks of the current thread do not lock the parents again, also when
+        // released in a different order
+        auto lock = list1.read_lock();
+        auto store_lock = store->read_lock();
+        auto sub_lock = sub.read_lock();
+        lock.unlock();
+        store_lock.unlock();
+        std::thread([&]() { EXPECT_FALSE(list1.try_write_lock(0.0)); }).join();
+    }
+    {
+        // a write lock covers the write locks below, which keep it until they are released
+        auto store_lock = store->write_lock();
+        auto lock = list1.write_lock();
+        store_lock.unlock();
+        std::thread([&]() { EXPECT_FALSE(list2.try_read_lock(0.0)); }).join();
+    }
+    std::thread([&]() { EXPECT_TRUE(store->try_write_lock(0.0)); }).join();
+    {
+        // the current thread may read the store while writing below it
+        auto lock = list1.write_lock();
+        EXPECT_TRUE(store->try_read_lock(0.0));
+        EXPECT_THROW(auto read_lock = list1.read_lock(), std::runtime_error);
+    }
+    EXPECT_TRUE(store->try_write_lock(0.0));
+    // a thread waiting for the others to release their share of a lock it also holds is woken
+    // up as soon as they did; the locks of this store are not checked for dead processes, which
+    // would wake it up every 10 ms
+    auto local_ref = stst::StructStore::create();
+    stst::StructStore& local = *local_ref;
+    stst::StructStore& local_sub = local["sub"];
+    stst::List& local_list1 = local_sub["list1"];
+    stst::List& local_list2 = local_sub["list2"];
+    auto wake_latency = [&](auto&& lock_own, auto&& lock_other, auto&& upgrade) {
+        std::atomic_bool locked{false};
+        std::atomic<int64_t> released_at{0};
+        auto own_lock = lock_own();
+        std::thread other([&]() {
+            auto lock = lock_other();
+            locked = true;
+            std::this_thread::sleep_for(std::chrono::milliseconds(50));
+            released_at = std::chrono::steady_clock::now().time_since_epoch().count();
+        });
+        while (!locked) { std::this_thread::yield(); }
+        EXPECT_TRUE(upgrade());
+        auto acquired_at = std::chrono::steady_clock::now().time_since_epoch().count();
+        other.join();
+        return std::chrono::nanoseconds(acquired_at - released_at);
+    };
+    // reading the store while writing below it
+    auto latency = wake_latency([&]() { return local_list1.write_lock(); },
+                                [&]() { return local_list2.write_lock(); },
+                                [&]() { return bool(local.try_read_lock(1.0)); });
+    EXPECT_LT(latency, std::chrono::milliseconds(5));
+    // writing below the store while reading it
+    latency = wake_latency([&]() { return local_sub.read_lock(); },
+                           [&]() { return local_sub.read_lock(); },
+                           [&]() { return bool(local_list1.try_write_lock(1.0)); });
+    EXPECT_LT(latency, std::chrono::milliseconds(5));
+}
+
+TEST(StructStoreTestLock, manyHeldLocks) {
+    stst::StructStoreShared store("/shmanylocks_store", 1 << 20, true, false, stst::ALWAYS);
+    // more parents than the inline table of held locks has entries
+    stst::StructStore* deep = &*store;
+    for (int level = 0; level < 100; ++level) { deep = &deep->substore("sub"); }
+    stst::List& deep_list = (*deep)["list"];
+    std::vector<stst::List*> lists;
+    for (int i = 0; i < 100; ++i) {
+        lists.push_back(&store["list" + std::to_string(i)].get<stst::List>());
+    }
+    {
+        auto deep_lock = deep_list.write_lock();
+        std::vector<stst::ScopedFieldLock<false>> locks;
+        for (stst::List* list: lists) { locks.push_back(list->read_lock()); }
+        std::thread([&]() {
+            EXPECT_FALSE(store->try_write_lock(0.0));
+            EXPECT_FALSE(deep->try_read_lock(0.0));
+            EXPECT_FALSE(lists[99]->try_write_lock(0.0));
+            EXPECT_TRUE(lists[99]->try_read_lock(0.0));
+        }).join();
+    }
+    // all locks were released again
+    std::thread([&]() { EXPECT_TRUE(store->try_write_lock(0.0)); }).join();
+    EXPECT_TRUE(deep_list.try_read_lock(0.0));
+}
+
+TEST(StructStoreTestLock, lockStats) {
+    stst::StructStoreShared store("/shlockstats_store", 16384, true, false, stst::ALWAYS);
+    stst::StructStore& sub = store["sub"];
+    stst::List& list = sub["list"];
+    stst::SpinMutex::reset_stats();
+    stst::SpinMutex::set_instrumentation(true);
+    std::thread reader;
+    {
+        auto lock = list.write_lock();
+        std::thread([&]() { EXPECT_FALSE(list.try_write_lock(0.0)); }).join();
+        reader = std::thread{[&]() { EXPECT_TRUE(list.try_read_lock(1.0)); }};
+        std::this_thread::sleep_for(std::chrono::milliseconds(20));
+        auto locks = store.contended_locks(1);
+        ASSERT_EQ(locks.size(), 1);
+        EXPECT_EQ(locks[0].first, "sub.list");
+        EXPECT_EQ(locks[0].second.holder_tid, stst::SpinMutex::get_tid());
+    }
+    reader.join();
+    auto locks = store.contended_locks(10);
+    ASSERT_GE(locks.size(), 3);
+    const stst::LockStats& stats = locks[0].second;
+    EXPECT_EQ(locks[0].first, "sub.list");
+    EXPECT_EQ(stats.acquisitions, 2);
+    EXPECT_EQ(stats.contended, 2);
+    EXPECT_EQ(stats.timeouts, 1);
+    EXPECT_GT(stats.spins, 0);
+    EXPECT_GE(stats.max_hold_nsecs, 20'000'000);
+    EXPECT_EQ(stats.max_hold_tid, stst::SpinMutex::get_tid());
+    EXPECT_EQ(stats.holder_tid, 0);
+    // the parents were locked with intentions, also by the failed writer; the locks for
+    // collecting the stats are not recorded
+    for (const auto& [path, stats]: locks) {
+        if (path == "sub") { EXPECT_EQ(stats.acquisitions, 3); }
+        if (path == "") { EXPECT_EQ(stats.acquisitions, 3); }
+    }
+    {
+        // a writer of another thread below the root leaves out the fields below it
+        std::atomic_bool locked{false};
+        std::atomic_bool done{false};
+        std::thread writer{[&]() {
+            auto lock = list.write_lock();
+            locked = true;
+            while (!done) { std::this_thread::yield(); }
+        }};
+        while (!locked) { std::this_thread::yield(); }
+        locks = store.contended_locks(10);
+        done = true;
+        writer.join();
+        ASSERT_FALSE(locks.empty());
+        for (const auto& [path, stats]: locks) {
+            EXPECT_TRUE(path == "" || path[0] == '<');
+            if (path == "") { EXPECT_EQ(stats.timeouts, 0); }
+        }
+    }
+    stst::SpinMutex::set_instrumentation(false);
+    stst::SpinMutex::reset_stats();
+    EXPECT_TRUE(store.contended_locks(10).empty());
+}
+
+TEST(StructStoreTestLock, writerPreference) {
+    stst::StructStoreShared store("/shwriterpref_store", 16384, true, false, stst::ALWAYS);
+    stst::StructStore& sub = store["sub"];
+    stst::List& list1 = sub["list1"];
+    stst::List& list2 = sub["list2"];
+    stst::SpinMutex::set_writer_preference(true);
+    {
+        auto lock = list1.write_lock();
+        std::atomic_bool written{false};
+        std::thread writer{[&]() {
+            EXPECT_TRUE(sub.try_write_lock(1.0));
+            written = true;
+        }};
+        std::this_thread::sleep_for(std::chrono::milliseconds(20));
+        // the waiting writer blocks new readers of the store
+        std::thread([&]() { EXPECT_FALSE(list2.try_read_lock(0.02)); }).join();
+        // but not the current thread, which it waits for
+        EXPECT_TRUE(sub.try_read_lock(0.0));
+        EXPECT_FALSE(written);
+        lock.unlock();
+        writer.join();
+    }
+    // continuous readers do not starve writers
+    std::atomic_bool stop{false};
+    std::vector<std::thread> readers;
+    for (int t = 0; t < 4; ++t) {
+        readers.emplace_back([&]() {
+            while (!stop) {
+                auto lock = list1.read_lock();
+                std::this_thread::sleep_for(std::chrono::microseconds(200));
+            }
+        });
+    }
+    for (int i = 0; i < 20; ++i) {
+        EXPECT_TRUE(list1.try_write_lock(0.05));
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+    stop = true;
+    for (auto& reader: readers) { reader.join(); }
+    stst::SpinMutex::set_writer_preference(false);
+
+    // a writer which dies while waiting does not block readers forever
+    void* mem = mmap(nullptr, sizeof(stst::SpinMutex), PROT_READ | PROT_WRITE,
+                     MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+    ASSERT_NE(mem, MAP_FAILED);
+    auto* mutex = new (mem) stst::SpinMutex{};
+    {
+        stst::ScopedLock<false> lock{*mutex};
+        pid_t pid = fork();
+        if (pid == 0) {
+            stst::SpinMutex::set_writer_preference(true);
+            stst::ScopedLock<true> write_lock{*mutex};
+            _exit(0);
+        }
+        std::this_thread::sleep_for(std::chrono::milliseconds(50));
+        kill(pid, SIGKILL);
+        waitpid(pid, nullptr, 0);
+    }
+    std::thread([&]() { EXPECT_NO_THROW(stst::ScopedLock<false>{*mutex}); }).join();
+    munmap(mem, sizeof(stst::SpinMutex));
+}
+
+TEST(StructStoreTestLock, deadOwner) {
+    struct Shared {
+        stst::SpinMutex mutex;
+        std::atomic_bool locked;
+    };
+    void* mem = mmap(nullptr, sizeof(Shared), PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS,
+                     -1, 0);
+    ASSERT_NE(mem, MAP_FAILED);
+    auto* shared = new (mem) Shared{};
+    uint64_t recoveries = stst::SpinMutex::get_recoveries();
+    pid_t pid = fork();
+    if (pid == 0) {
+        stst::ScopedLock<true> lock{shared->mutex};
+        shared->locked = true;
+        _exit(0);
+    }
+    while (!shared->locked) { std::this_thread::yield(); }
+    // the child is a zombie until it is reaped
+    {
+        stst::ScopedLock<true> lock{shared->mutex};
+        EXPECT_EQ(stst::SpinMutex::get_recoveries(), recoveries + 1);
+        EXPECT_TRUE(shared->mutex.is_suspect());
+        shared->mutex.clear_suspect();
+        EXPECT_FALSE(shared->mutex.is_suspect());
+    }
+    waitpid(pid, nullptr, 0);
+    munmap(mem, sizeof(Shared));
+
+    stst::StructStoreShared store("/shdeadowner_store", 16384, true, false, stst::ALWAYS);
+    store["num"] = 5;
+    pid = fork();
+    if (pid == 0) {
+        auto lock = store->write_lock();
+        store["num"] = 6;
+        _exit(0);
+    }
+    waitpid(pid, nullptr, 0);
+    // the store is checked before it is locked again
+    EXPECT_TRUE(store->try_write_lock(1.0));
+    EXPECT_EQ(stst::SpinMutex::get_recoveries(), recoveries + 2);
+    EXPECT_EQ(store["num"].get<int>(), 6);
+    EXPECT_TRUE(store->try_read_lock(0.0));
+
+    // the read and intention locks of the dead process are released, too
+    stst::StructStore& sub = store["sub"];
+    stst::List& list1 = sub["list1"];
+    stst::List& list2 = sub["list2"];
+    sub.make_read_scalable();
+    pid = fork();
+    if (pid == 0) {
+        auto read_lock = list1.read_lock();
+        auto write_lock = list2.write_lock();
+        _exit(0);
+    }
+    waitpid(pid, nullptr, 0);
+    EXPECT_TRUE(store->try_write_lock(1.0));
+    // the entries of list1, sub and the store
+    EXPECT_EQ(stst::SpinMutex::get_recoveries(), recoveries + 5);
+    EXPECT_TRUE(list1.try_write_lock(0.0));
+    EXPECT_TRUE(sub.try_read_lock(0.0));
+    EXPECT_TRUE(list2.try_write_lock(1.0));
+    EXPECT_EQ(stst::SpinMutex::get_recoveries(), recoveries + 6);
+}
@@ -80,3 +80,26 @@ class TestLock0(unittest.TestCase):
 
         # extending by itself would need a read lock and a write lock
         self.assertRaises(RuntimeError, extend_by_self)
+
+    def test_lock_timeout(self):
+        state = stst.StructStore()
+        state.lst = []
+        with state.lst.read_lock():
+            # the read lock of this thread is not upgraded
+            self.assertIsNone(state.lst.try_write_lock())
+            self.assertIsNone(state.lst.try_write_lock(timeout=0.01))
+            with state.lst.try_read_lock() as lock:
+                pass
+        lock = state.lst.try_write_lock(timeout=0.01)
+        self.assertIsNotNone(lock)
+        del lock
+
+        shmem = stst.StructStoreShared("/lock_timeout_store", 16384)
+        self.assertAlmostEqual(shmem.lock_timeout, 0.1)
+        shmem.lock_timeout = 0.0
+        shmem.store.lst = []
+        with shmem.store.lst.read_lock():
+            # fails at once instead of after 0.1 s
+            self.assertRaises(RuntimeError, lambda: shmem.store.lst.append(5))
+        shmem.lock_timeout = -1.0
+        shmem.store.lst.append(5)
@@ -30,3 +30,24 @@ class TestShared0(unittest.TestCase):
             shmem.state = State(5, 3.14, "foo", True, Substate(42), [0, 1])
         self.assertEqual(shmem.deepcopy(), shmem.store.deepcopy())
         shmem.check()
+
+    def test_shared_growing(self):
+        shmem = structstore.StructStoreShared(
+            "/dyn_shgrowing_store", 4096, reinit=True, cleanup=structstore.CleanupMode.ALWAYS,
+            max_size=1 << 20)
+        shmem.mat = np.ones((64, 64))
+        self.assertGreater(len(shmem.to_bytes()), 64 * 64 * 8)
+        self.assertEqual(shmem.mat[63, 63], 1.0)
+        shmem.check()
+
+    def test_shared_stats(self):
+        shmem = structstore.StructStoreShared(
+            "/dyn_shstats_store", 16384, reinit=True, cleanup=structstore.CleanupMode.ALWAYS)
+        stats = shmem.stats()
+        self.assertLessEqual(stats["used_bytes"] + stats["free_bytes"], stats["total_bytes"])
+        shmem.lst = list(range(100))
+        stats2 = shmem.stats()
+        self.assertGreater(stats2["used_bytes"], stats["used_bytes"])
+        self.assertGreaterEqual(stats2["high_water_bytes"], stats2["used_bytes"])
+        self.assertEqual(sum(stats2["free_bytes_per_class"].values()), stats2["free_bytes"])
+        self.assertGreaterEqual(stats2["fragmentation"], 0.0)